@@ -0,0 +1,461 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "BinaryJournal.hxx"
+#include "Record.hxx"
+#include "Log.hxx"
+#include "lib/fmt/RuntimeError.hxx"
+#include "util/CRC32.hxx"
+#include "util/SpanCast.hxx"
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+static constexpr char MAGIC[8] = {'M', 'P', 'D', 'S', 'C', 'R', 'B', 'J'};
+static constexpr uint_least32_t VERSION = 1;
+static constexpr std::size_t HEADER_SIZE = sizeof(MAGIC) + 8;
+
+enum class FrameType : uint_least8_t {
+	RECORD = 1,
+	ACK = 2,
+
+	/**
+	 * Shared journals only: a scrobbler has submitted all records
+	 * before the given sequence number.
+	 */
+	CURSOR = 3,
+
+	/**
+	 * Shared journals only: the sequence number of the first
+	 * record in the file.
+	 */
+	BASE = 4,
+};
+
+static constexpr uint_least8_t FLAG_LOVE = 0x1;
+static constexpr uint_least8_t FLAG_RADIO = 0x2;
+
+static void
+AppendU32(std::string &dest, uint_least32_t value) noexcept
+{
+	for (unsigned i = 0; i < 4; ++i)
+		dest.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+}
+
+static void
+AppendU64(std::string &dest, uint_least64_t value) noexcept
+{
+	AppendU32(dest, value & 0xffffffff);
+	AppendU32(dest, value >> 32);
+}
+
+static void
+AppendString(std::string &dest, std::string_view value) noexcept
+{
+	AppendU32(dest, value.size());
+	dest.append(value);
+}
+
+[[gnu::pure]]
+static uint_least32_t
+LoadU32(const std::byte *p) noexcept
+{
+	return static_cast<uint_least32_t>(p[0]) |
+		(static_cast<uint_least32_t>(p[1]) << 8) |
+		(static_cast<uint_least32_t>(p[2]) << 16) |
+		(static_cast<uint_least32_t>(p[3]) << 24);
+}
+
+[[gnu::pure]]
+static uint_least64_t
+LoadU64(const std::byte *p) noexcept
+{
+	return LoadU32(p) | (static_cast<uint_least64_t>(LoadU32(p + 4)) << 32);
+}
+
+static void
+AppendFrame(std::string &dest, std::string_view payload) noexcept
+{
+	AppendU32(dest, payload.size());
+	AppendU32(dest, CRC32(AsBytes(payload)));
+	dest.append(payload);
+}
+
+bool
+binary_journal_check_header(std::span<const std::byte> src) noexcept
+{
+	return src.size() >= HEADER_SIZE &&
+		memcmp(src.data(), MAGIC, sizeof(MAGIC)) == 0;
+}
+
+void
+binary_journal_encode_header(std::string &dest) noexcept
+{
+	dest.append(MAGIC, sizeof(MAGIC));
+	AppendU32(dest, VERSION);
+	AppendU32(dest, 0);
+}
+
+void
+binary_journal_encode_record(std::string &dest, const Record &record) noexcept
+{
+	uint_least8_t flags = 0;
+	if (record.IsLoved())
+		flags |= FLAG_LOVE;
+	if (record.IsRadio())
+		flags |= FLAG_RADIO;
+
+	std::string payload;
+	payload.push_back(static_cast<char>(FrameType::RECORD));
+	payload.push_back(static_cast<char>(flags));
+	AppendU32(payload, record.GetLength().count());
+	AppendU64(payload, record.GetTimestamp());
+	AppendString(payload, record.GetArtist());
+	AppendString(payload, record.GetTrack());
+	AppendString(payload, record.GetAlbum());
+	AppendString(payload, record.GetNumber());
+	AppendString(payload, record.GetMbid());
+
+	AppendFrame(dest, payload);
+}
+
+void
+binary_journal_write_record(FILE *file, const Record &record) noexcept
+{
+	std::string frame;
+	binary_journal_encode_record(frame, record);
+	fwrite(frame.data(), 1, frame.size(), file);
+}
+
+void
+binary_journal_encode_ack(std::string &dest, unsigned n) noexcept
+{
+	std::string payload;
+	payload.push_back(static_cast<char>(FrameType::ACK));
+	AppendU32(payload, n);
+
+	AppendFrame(dest, payload);
+}
+
+namespace {
+
+/**
+ * Helper class which decodes the fields of one frame payload.
+ */
+class PayloadReader {
+	std::span<const std::byte> src;
+
+public:
+	explicit constexpr PayloadReader(std::span<const std::byte> _src) noexcept
+		:src(_src) {}
+
+	bool ReadU8(uint_least8_t &value_r) noexcept {
+		if (src.empty())
+			return false;
+
+		value_r = static_cast<uint_least8_t>(src.front());
+		src = src.subspan(1);
+		return true;
+	}
+
+	bool ReadU32(uint_least32_t &value_r) noexcept {
+		if (src.size() < 4)
+			return false;
+
+		value_r = LoadU32(src.data());
+		src = src.subspan(4);
+		return true;
+	}
+
+	bool ReadU64(uint_least64_t &value_r) noexcept {
+		if (src.size() < 8)
+			return false;
+
+		value_r = LoadU64(src.data());
+		src = src.subspan(8);
+		return true;
+	}
+
+	/**
+	 * Read a string.  The returned view points into the source
+	 * buffer, no copy is made.
+	 */
+	bool ReadString(std::string_view &value_r) noexcept {
+		uint_least32_t length;
+		if (!ReadU32(length) || src.size() < length)
+			return false;
+
+		value_r = ToStringView(src.first(length));
+		src = src.subspan(length);
+		return true;
+	}
+};
+
+} // anonymous namespace
+
+namespace {
+
+/**
+ * The fields of a record frame.  The strings point into the payload.
+ */
+struct RecordFields {
+	uint_least8_t flags;
+	uint_least32_t length;
+	uint_least64_t time;
+	std::string_view artist, track, album, number, mbid;
+
+	bool Parse(PayloadReader &r) noexcept {
+		return r.ReadU8(flags) && r.ReadU32(length) &&
+			r.ReadU64(time) &&
+			r.ReadString(artist) &&
+			r.ReadString(track) &&
+			r.ReadString(album) &&
+			r.ReadString(number) &&
+			r.ReadString(mbid) &&
+			!artist.empty() && !track.empty();
+	}
+};
+
+} // anonymous namespace
+
+static bool
+DecodeRecord(PayloadReader &r, RecordQueue &queue) noexcept
+{
+	RecordFields f;
+	if (!f.Parse(r))
+		return false;
+
+	queue.emplace_back(std::make_shared<const Record>(f.artist, f.track,
+							  f.album, f.number, f.mbid,
+							  std::chrono::sys_seconds{std::chrono::seconds{static_cast<int_least64_t>(f.time)}},
+							  std::chrono::seconds{f.length},
+							  (f.flags & FLAG_LOVE) != 0,
+							  (f.flags & FLAG_RADIO) != 0));
+	return true;
+}
+
+std::size_t
+binary_journal_read_records(FILE *file, RecordQueue &queue,
+			    std::size_t max) noexcept
+{
+	std::size_t n = 0;
+	std::string payload;
+
+	while (n < max) {
+		std::byte header[8];
+		if (fread(header, 1, sizeof(header), file) != sizeof(header))
+			break;
+
+		const std::size_t size = LoadU32(header);
+		const uint_least32_t crc = LoadU32(header + 4);
+
+		payload.resize(size);
+		if (fread(payload.data(), 1, size, file) != size ||
+		    CRC32(AsBytes(payload)) != crc)
+			break;
+
+		PayloadReader r{AsBytes(payload)};
+		uint_least8_t type;
+		if (!r.ReadU8(type) ||
+		    static_cast<FrameType>(type) != FrameType::RECORD ||
+		    !DecodeRecord(r, queue))
+			break;
+
+		++n;
+	}
+
+	return n;
+}
+
+/**
+ * Invoke the given function for each frame of a binary journal file
+ * with the frame offset, the frame type and a #PayloadReader for the
+ * rest of the payload.  Stops at the first truncated or corrupt
+ * frame.  Throws if the file version is not supported.
+ *
+ * @return false if a truncated or corrupt frame was found
+ */
+template<typename F>
+static bool
+ForEachFrame(const char *path, std::span<const std::byte> src, F &&f)
+{
+	assert(binary_journal_check_header(src));
+
+	if (const auto version = LoadU32(src.data() + sizeof(MAGIC));
+	    version != VERSION)
+		throw FmtRuntimeError("Unsupported journal version {} in {:?}",
+				      version, path);
+
+	const std::byte *const begin = src.data();
+	src = src.subspan(HEADER_SIZE);
+
+	while (!src.empty()) {
+		const std::size_t offset = src.data() - begin;
+
+		if (src.size() < 8) {
+			FmtWarning("Truncated frame in {:?} at offset {}",
+				   path, offset);
+			return false;
+		}
+
+		const std::size_t size = LoadU32(src.data());
+		const uint_least32_t crc = LoadU32(src.data() + 4);
+		src = src.subspan(8);
+
+		if (src.size() < size) {
+			FmtWarning("Truncated frame in {:?} at offset {}",
+				   path, src.data() - begin);
+			return false;
+		}
+
+		const auto payload = src.first(size);
+		src = src.subspan(size);
+
+		if (CRC32(payload) != crc) {
+			FmtWarning("Checksum mismatch in {:?} at offset {}",
+				   path, payload.data() - begin);
+			return false;
+		}
+
+		PayloadReader r{payload};
+		uint_least8_t type;
+		if (r.ReadU8(type))
+			f(offset, static_cast<FrameType>(type), r);
+	}
+
+	return true;
+}
+
+void
+binary_journal_index(const char *path, std::span<const std::byte> src,
+		     std::deque<std::size_t> &offsets_r,
+		     unsigned &n_acked_r, bool &complete_r)
+{
+	n_acked_r = 0;
+
+	complete_r = ForEachFrame(path, src, [&](std::size_t offset,
+						 FrameType type,
+						 PayloadReader &r){
+		switch (type) {
+		case FrameType::RECORD:
+			/* check the record now, so the acknowledgments
+			   count the same records as DecodeRecord()
+			   will produce later */
+			if (RecordFields f; f.Parse(r))
+				offsets_r.push_back(offset);
+			break;
+
+		case FrameType::ACK:
+			if (uint_least32_t n; r.ReadU32(n))
+				n_acked_r += RemoveOldest(offsets_r, n);
+			break;
+
+		case FrameType::CURSOR:
+		case FrameType::BASE:
+			/* only used by shared journals */
+			break;
+		}
+	});
+}
+
+bool
+binary_journal_index_shared(const char *path, std::span<const std::byte> src,
+			    SharedJournalIndex &index)
+{
+	return ForEachFrame(path, src, [&index](std::size_t offset,
+						FrameType type,
+						PayloadReader &r){
+		switch (type) {
+		case FrameType::RECORD:
+			/* each record frame has a sequence number,
+			   even if it is corrupt */
+			if (RecordFields f; f.Parse(r)) {
+				index.offsets.push_back(offset);
+				index.seqs.push_back(index.end);
+			}
+
+			++index.end;
+			break;
+
+		case FrameType::ACK:
+			/* only used by private journals */
+			break;
+
+		case FrameType::CURSOR:
+			if (std::string_view name; r.ReadString(name)) {
+				if (uint_least64_t seq; r.ReadU64(seq))
+					index.cursors.insert_or_assign(std::string{name},
+								       seq);
+			}
+			break;
+
+		case FrameType::BASE:
+			if (uint_least64_t base; r.ReadU64(base))
+				index.base = index.end = base;
+			break;
+		}
+	});
+}
+
+void
+binary_journal_encode_cursor(std::string &dest, std::string_view name,
+			     uint_least64_t seq) noexcept
+{
+	std::string payload;
+	payload.push_back(static_cast<char>(FrameType::CURSOR));
+	AppendString(payload, name);
+	AppendU64(payload, seq);
+
+	AppendFrame(dest, payload);
+}
+
+void
+binary_journal_encode_base(std::string &dest, uint_least64_t seq) noexcept
+{
+	std::string payload;
+	payload.push_back(static_cast<char>(FrameType::BASE));
+	AppendU64(payload, seq);
+
+	AppendFrame(dest, payload);
+}
+
+std::span<const std::byte>
+binary_journal_get_frame(std::span<const std::byte> src,
+			 std::size_t offset) noexcept
+{
+	if (offset > src.size() || src.size() - offset < 8)
+		return {};
+
+	src = src.subspan(offset);
+
+	const std::size_t size = LoadU32(src.data());
+	if (src.size() - 8 < size)
+		return {};
+
+	return src.first(8 + size);
+}
+
+bool
+binary_journal_decode(std::span<const std::byte> src, std::size_t offset,
+		      RecordQueue &queue) noexcept
+{
+	if (offset > src.size() || src.size() - offset < 8)
+		return false;
+
+	src = src.subspan(offset);
+
+	const std::size_t size = LoadU32(src.data());
+	src = src.subspan(8);
+	if (src.size() < size)
+		return false;
+
+	/* the checksum has already been verified by
+	   binary_journal_index() */
+	PayloadReader r{src.first(size)};
+	uint_least8_t type;
+	return r.ReadU8(type) &&
+		static_cast<FrameType>(type) == FrameType::RECORD &&
+		DecodeRecord(r, queue);
+}
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef BINARY_JOURNAL_HXX
+#define BINARY_JOURNAL_HXX
+
+/*
+ * The binary journal format.  The file begins with a 16 byte header
+ * (magic, version, reserved), followed by frames.  Each frame
+ * consists of a 32 bit payload length, the CRC-32 of the payload and
+ * the payload itself; the first payload byte is the frame type.  All
+ * integers are little-endian.
+ */
+
+#include "RecordQueue.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <span>
+#include <string>
+
+#include <stdio.h>
+
+/**
+ * Does the given file contents begin with a binary journal header?
+ */
+[[gnu::pure]]
+bool
+binary_journal_check_header(std::span<const std::byte> src) noexcept;
+
+void
+binary_journal_encode_header(std::string &dest) noexcept;
+
+/**
+ * Append a record frame to the given buffer.
+ */
+void
+binary_journal_encode_record(std::string &dest, const Record &record) noexcept;
+
+void
+binary_journal_write_record(FILE *file, const Record &record) noexcept;
+
+void
+binary_journal_encode_ack(std::string &dest, unsigned n) noexcept;
+
+/**
+ * Read record frames (without a file header) from the current
+ * position of the given stream, as written by
+ * binary_journal_write_record().
+ *
+ * @param max the maximum number of records to read
+ * @return the number of records appended to the queue; less than
+ * #max at the end of the file or if a frame is corrupt
+ */
+std::size_t
+binary_journal_read_records(FILE *file, RecordQueue &queue,
+			    std::size_t max) noexcept;
+
+/**
+ * Scan all frames of a binary journal file and replay them, but only
+ * collect the file offsets of the records which have not been
+ * acknowledged instead of decoding them.  Scanning stops at the
+ * first truncated or corrupt frame.  Throws if the file version is
+ * not supported.
+ *
+ * @param path the file path (for log messages)
+ * @param src the whole file contents including the header
+ * @param offsets_r receives the offsets (oldest first)
+ * @param n_acked_r receives the number of acknowledged records
+ * which are still in the file
+ * @param complete_r receives false if scanning stopped at a
+ * corrupt frame
+ */
+void
+binary_journal_index(const char *path, std::span<const std::byte> src,
+		     std::deque<std::size_t> &offsets_r,
+		     unsigned &n_acked_r, bool &complete_r);
+
+/**
+ * The index of a shared journal file (see #SharedJournal).  Records
+ * are identified by a sequence number which increases by one for
+ * each record appended to the file.
+ */
+struct SharedJournalIndex {
+	/**
+	 * The sequence number of the first record in the file.
+	 */
+	uint_least64_t base = 0;
+
+	/**
+	 * The sequence number of the next record to be appended.
+	 */
+	uint_least64_t end = 0;
+
+	/**
+	 * The offsets of all intact records and their sequence
+	 * numbers.
+	 */
+	std::deque<std::size_t> offsets;
+	std::deque<uint_least64_t> seqs;
+
+	/**
+	 * The cursor of each scrobbler: the sequence number of the
+	 * oldest record it has not submitted yet.
+	 */
+	std::map<std::string, uint_least64_t, std::less<>> cursors;
+};
+
+/**
+ * Scan all frames of a shared journal file.  Scanning stops at the
+ * first truncated or corrupt frame.  Throws if the file version is
+ * not supported.
+ *
+ * @return false if scanning stopped at a corrupt frame
+ */
+bool
+binary_journal_index_shared(const char *path, std::span<const std::byte> src,
+			    SharedJournalIndex &index);
+
+void
+binary_journal_encode_cursor(std::string &dest, std::string_view name,
+			     uint_least64_t seq) noexcept;
+
+void
+binary_journal_encode_base(std::string &dest, uint_least64_t seq) noexcept;
+
+/**
+ * Returns the complete frame (including its header) at the given
+ * offset, or an empty span if it is truncated.
+ */
+[[gnu::pure]]
+std::span<const std::byte>
+binary_journal_get_frame(std::span<const std::byte> src,
+			 std::size_t offset) noexcept;
+
+/**
+ * Decode the record frame at the given offset (obtained from
+ * binary_journal_index()) and append it to the queue.
+ *
+ * @return false if there is no valid record at this offset
+ */
+bool
+binary_journal_decode(std::span<const std::byte> src, std::size_t offset,
+		      RecordQueue &queue) noexcept;
+
+#endif
@@ -4,6 +4,7 @@
 #ifndef CONFIG_HXX
 #define CONFIG_HXX
 
+#include "MpdConfig.hxx"
 #include "ScrobblerConfig.hxx"
 
 #include <forward_list>
@@ -42,12 +43,38 @@ struct Config {
 	 */
 	unsigned journal_interval = 600;
 
+	/**
+	 * If non-zero, the journal is saved this many seconds after
+	 * it has changed instead of after #journal_interval.
+	 */
+	unsigned journal_save_delay = 0;
+
+	/**
+	 * The path of the journal file shared by all scrobblers
+	 * which have no "journal" setting.  If empty, each scrobbler
+	 * has its own journal.
+	 */
+	std::string shared_journal;
+
+	/**
+	 * The delay in milliseconds before a "now playing"
+	 * notification is sent.  If another song starts during that
+	 * time, only the new one is announced.
+	 */
+	unsigned now_playing_delay = 1000;
+
 	int verbose = -1;
 	enum file_location loc = file_unknown;
 
 	// Key=file path, value=loaded ignore list
 	IgnoreListMap ignore_lists;
 	std::forward_list<ScrobblerConfig> scrobblers;
+
+	/**
+	 * The "[mpd:NAME]" sections.  If there are none,
+	 * file_read_config() adds one with #host and #port.
+	 */
+	std::forward_list<MpdConfig> mpds;
 };
 
 #endif
@@ -12,9 +12,37 @@ FormDataBuilder::AppendVerbatim(unsigned value) noexcept
 	AppendVerbatim(fmt::format_int{value}.c_str());
 }
 
+void
+FormDataBuilder::AppendInteger(int_least64_t value) noexcept
+{
+	AppendVerbatim(fmt::format_int{value}.c_str());
+}
+
 void
 FormDataBuilder::AppendEscape(std::string_view value) noexcept
 {
 	if (auto e = CurlEscape(value))
 		s.append(e);
 }
+
+void
+FormDataBuilder::AppendFragment(std::string_view fragment,
+				unsigned idx) noexcept
+{
+	AppendSeparator();
+
+	const fmt::format_int idx_buffer{idx};
+	const std::string_view idx_string{idx_buffer.data(), idx_buffer.size()};
+
+	while (true) {
+		const auto placeholder = fragment.find("[]");
+		if (placeholder == fragment.npos)
+			break;
+
+		s.append(fragment.substr(0, placeholder + 1));
+		s.append(idx_string);
+		fragment = fragment.substr(placeholder + 1);
+	}
+
+	s.append(fragment);
+}
@@ -4,7 +4,10 @@
 #ifndef FORM_HXX
 #define FORM_HXX
 
+#include <concepts>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 class FormDataBuilder {
 	std::string s;
@@ -56,6 +59,27 @@ public:
 		AppendEscape(std::forward<V>(value));
 	}
 
+	/**
+	 * Like AppendIndexed(), but leave the index empty ("key[]").
+	 * This builds a fragment for AppendFragment().
+	 */
+	template<typename K, typename V>
+	void AppendIndexPlaceholder(K &&key, V &&value) noexcept {
+		AppendSeparator();
+
+		AppendVerbatim(std::forward<K>(key));
+		s.append("[]=");
+		AppendEscape(std::forward<V>(value));
+	}
+
+	/**
+	 * Append a pre-encoded fragment which was built with
+	 * AppendIndexPlaceholder(), inserting the given index into
+	 * each "[]".  This needs no escaping, because an escaped value
+	 * never contains brackets.
+	 */
+	void AppendFragment(std::string_view fragment, unsigned idx) noexcept;
+
 private:
 	void AppendSeparator() noexcept {
 		switch (separator) {
@@ -81,10 +105,13 @@ private:
 
 	void AppendVerbatim(unsigned value) noexcept;
 
+	void AppendInteger(int_least64_t value) noexcept;
+
 	void AppendEscape(std::string_view value) noexcept;
 
-	void AppendEscape(unsigned value) noexcept {
-		AppendVerbatim(value);
+	template<std::integral T>
+	void AppendEscape(T value) noexcept {
+		AppendInteger(value);
 	}
 };
 
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "HostHealth.hxx"
+#include "Log.hxx"
+
+#include <algorithm> // for std::max()
+#include <random>
+
+std::string_view
+HostHealth::GetKey(std::string_view url) noexcept
+{
+	std::size_t start = url.find("://");
+	start = start != url.npos ? start + 3 : 0;
+
+	const auto end = url.find('/', start);
+	return url.substr(0, end);
+}
+
+Event::Duration
+HostHealth::Jitter(Event::Duration d) noexcept
+{
+	static std::minstd_rand generator{std::random_device{}()};
+
+	if (d <= Event::Duration::zero())
+		return d;
+
+	std::uniform_int_distribution<Event::Duration::rep> distribution{0, d.count() / 2};
+	return d - Event::Duration{distribution(generator)};
+}
+
+bool
+HostHealth::Acquire(Event::TimePoint now) noexcept
+{
+	switch (state) {
+	case State::CLOSED:
+		return true;
+
+	case State::OPEN:
+	case State::PROBING:
+		/* in PROBING state, #retry_at is the probe timeout:
+		   if the probe got lost, send another one */
+		if (now < retry_at)
+			return false;
+
+		FmtInfo("[{}] sending probe request", name);
+		state = State::PROBING;
+		retry_at = now + PROBE_TIMEOUT;
+		return true;
+	}
+
+	return true;
+}
+
+void
+HostHealth::Release(Event::TimePoint now) noexcept
+{
+	if (state != State::PROBING)
+		return;
+
+	state = State::OPEN;
+	retry_at = now;
+
+	for (auto *listener : listeners)
+		listener->OnProbeReleased();
+}
+
+Event::Duration
+HostHealth::GetDelay(Event::TimePoint now) const noexcept
+{
+	if (state == State::CLOSED)
+		return Event::Duration::zero();
+
+	if (now >= retry_at)
+		return Event::Duration::zero();
+
+	/* the jitter is added (not subtracted) here, because the
+	   request must not be sent before #retry_at */
+	const auto remaining = retry_at - now;
+	return 2 * remaining - Jitter(remaining);
+}
+
+void
+HostHealth::OnSuccess() noexcept
+{
+	failures = 0;
+	n_opened = 0;
+
+	if (state == State::CLOSED)
+		return;
+
+	FmtInfo("[{}] host has recovered", name);
+	state = State::CLOSED;
+
+	for (auto *listener : listeners)
+		listener->OnHostRecovered();
+}
+
+void
+HostHealth::OnFailure(Event::TimePoint now,
+		      Event::Duration retry_after) noexcept
+{
+	++failures;
+
+	switch (state) {
+	case State::CLOSED:
+		if (failures >= FAILURE_THRESHOLD ||
+		    retry_after > Event::Duration::zero())
+			Open(now, retry_after);
+		break;
+
+	case State::OPEN:
+		/* another request which was already in flight; don't
+		   increase the backoff again, but respect the
+		   server's hint */
+		retry_at = std::max(retry_at, now + retry_after);
+		break;
+
+	case State::PROBING:
+		Open(now, retry_after);
+		break;
+	}
+}
+
+void
+HostHealth::Open(Event::TimePoint now, Event::Duration retry_after) noexcept
+{
+	auto backoff = MIN_BACKOFF;
+	for (unsigned i = 0; i < n_opened && backoff < MAX_BACKOFF; ++i)
+		backoff *= 2;
+
+	backoff = Jitter(std::min(backoff, MAX_BACKOFF));
+	backoff = std::max(backoff, retry_after);
+
+	++n_opened;
+	state = State::OPEN;
+	retry_at = now + backoff;
+
+	FmtWarning("[{}] pausing requests for {} seconds after {} failure{}",
+		   name,
+		   std::chrono::duration_cast<std::chrono::duration<unsigned>>(backoff).count(),
+		   failures, failures == 1 ? "" : "s");
+}
@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef HOST_HEALTH_HXX
+#define HOST_HEALTH_HXX
+
+#include "event/Chrono.hxx"
+
+#include <forward_list>
+#include <string>
+#include <string_view>
+
+/**
+ * Gets notified when a #HostHealth recovers.
+ */
+class HostHealthListener {
+public:
+	/**
+	 * The circuit breaker has been closed: requests which were
+	 * postponed may be sent now.
+	 */
+	virtual void OnHostRecovered() noexcept = 0;
+
+	/**
+	 * The caller which was granted the probe had nothing to
+	 * send or has canceled it (see HostHealth::Release()):
+	 * postponed requests may try HostHealth::Acquire() again.
+	 */
+	virtual void OnProbeReleased() noexcept = 0;
+};
+
+/**
+ * The health of one scrobbler host, shared by all scrobblers which
+ * submit to it.  It implements a circuit breaker: after
+ * #FAILURE_THRESHOLD consecutive failures (or if the server asks us
+ * to back off with "Retry-After"), the circuit opens and no requests
+ * are sent until a jittered exponential backoff delay has expired.
+ * Then one scrobbler sends a single probe request on behalf of all
+ * others, and if it succeeds, the circuit closes and all of them
+ * resume.
+ */
+class HostHealth {
+	static constexpr unsigned FAILURE_THRESHOLD = 3;
+
+	static constexpr Event::Duration MIN_BACKOFF = std::chrono::minutes{1};
+	static constexpr Event::Duration MAX_BACKOFF = std::chrono::minutes{16};
+
+	/**
+	 * If the probe request does not finish within this duration,
+	 * another one may be sent.
+	 */
+	static constexpr Event::Duration PROBE_TIMEOUT = std::chrono::minutes{2};
+
+	const std::string name;
+
+	std::forward_list<HostHealthListener *> listeners;
+
+	enum class State {
+		/**
+		 * The host is healthy, requests may be sent.
+		 */
+		CLOSED,
+
+		/**
+		 * Too many failures: no requests until #retry_at.
+		 */
+		OPEN,
+
+		/**
+		 * A probe request is in flight; other requests wait
+		 * for its result.
+		 */
+		PROBING,
+	} state = State::CLOSED;
+
+	/**
+	 * The number of consecutive failures.
+	 */
+	unsigned failures = 0;
+
+	/**
+	 * How often has the circuit been opened since the host was
+	 * healthy the last time?  This is the exponent of the
+	 * backoff delay.
+	 */
+	unsigned n_opened = 0;
+
+	/**
+	 * #State::OPEN: the time when the probe request may be sent.
+	 * #State::PROBING: the time when the probe is considered
+	 * lost.
+	 */
+	Event::TimePoint retry_at;
+
+public:
+	explicit HostHealth(std::string_view _name) noexcept
+		:name(_name) {}
+
+	HostHealth(const HostHealth &) = delete;
+	HostHealth &operator=(const HostHealth &) = delete;
+
+	/**
+	 * Extract the part of the URL which identifies the host
+	 * ("scheme://host:port").
+	 */
+	[[gnu::pure]]
+	static std::string_view GetKey(std::string_view url) noexcept;
+
+	/**
+	 * Returns a random duration between half and all of the
+	 * given one.  This spreads out retries of several clients.
+	 */
+	static Event::Duration Jitter(Event::Duration d) noexcept;
+
+	void AddListener(HostHealthListener &listener) noexcept {
+		listeners.push_front(&listener);
+	}
+
+	void RemoveListener(HostHealthListener &listener) noexcept {
+		listeners.remove(&listener);
+	}
+
+	/**
+	 * Ask for permission to send a request.  If the circuit is
+	 * open and the backoff delay has expired, the caller gets to
+	 * send the probe request.
+	 *
+	 * @return true if the request may be sent; false if the
+	 * caller shall try again after GetDelay()
+	 */
+	bool Acquire(Event::TimePoint now) noexcept;
+
+	/**
+	 * Is a probe request in flight?  If Acquire() has just
+	 * returned true, the caller has been granted the probe and
+	 * shall send only one request.
+	 */
+	bool IsProbing() const noexcept {
+		return state == State::PROBING;
+	}
+
+	/**
+	 * The caller which was granted the probe by Acquire() has
+	 * nothing to send, or it has canceled the probe request:
+	 * let another one send the probe right away instead of
+	 * waiting for the probe timeout.
+	 */
+	void Release(Event::TimePoint now) noexcept;
+
+	/**
+	 * Returns the (jittered) duration after which Acquire() may
+	 * succeed, or zero if the circuit is closed.
+	 */
+	Event::Duration GetDelay(Event::TimePoint now) const noexcept;
+
+	/**
+	 * The host has responded.
+	 */
+	void OnSuccess() noexcept;
+
+	/**
+	 * A request has failed because the host is unreachable or
+	 * overloaded.
+	 *
+	 * @param retry_after the server's "Retry-After" hint (zero
+	 * if there is none)
+	 */
+	void OnFailure(Event::TimePoint now,
+		       Event::Duration retry_after) noexcept;
+
+private:
+	void Open(Event::TimePoint now, Event::Duration retry_after) noexcept;
+};
+
+#endif
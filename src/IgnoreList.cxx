@@ -23,13 +23,13 @@ IgnoreListEntry::matches_record(const Record& record) const noexcept
 	assert(!artist.empty() || !album.empty() || !title.empty());
 
 	/*
-	   Note the mismatch of 'title' and 'track' field names with the Record structure.
-	   This is not a bug - the Record structure does not use the expected field names.
+	   Note the mismatch of 'title' and 'track' field names with the Record class.
+	   This is not a bug - the Record class does not use the expected field names.
 	*/
-	return MatchIgnoreIfSpecified(artist, record.artist) &&
-	       MatchIgnoreIfSpecified(album, record.album) &&
-	       MatchIgnoreIfSpecified(title, record.track) &&
-	       MatchIgnoreIfSpecified(track, record.number);
+	return MatchIgnoreIfSpecified(artist, record.GetArtist()) &&
+	       MatchIgnoreIfSpecified(album, record.GetAlbum()) &&
+	       MatchIgnoreIfSpecified(title, record.GetTrack()) &&
+	       MatchIgnoreIfSpecified(track, record.GetNumber());
 }
 
 bool
@@ -17,7 +17,8 @@
 static constexpr bool
 IsValidSectionNameChar(char ch) noexcept
 {
-	return IsAlphaNumericASCII(ch) || ch == '_' || ch == '-' || ch == '.';
+	return IsAlphaNumericASCII(ch) || ch == '_' || ch == '-' || ch == '.' ||
+		ch == ':';
 }
 
 [[gnu::pure]]
@@ -62,7 +63,7 @@ class IniParser {
 	IniFile::iterator section;
 
 public:
-	void ParseLine(std::string_view line);
+	void ParseLine(std::string_view line, unsigned line_number);
 
 	auto Commit() noexcept {
 		return std::move(data);
@@ -70,7 +71,7 @@ public:
 };
 
 void
-IniParser::ParseLine(std::string_view line)
+IniParser::ParseLine(std::string_view line, unsigned line_number)
 {
 	line = StripLeft(line);
 	if (line.empty() || line.front() == '#')
@@ -115,7 +116,9 @@ IniParser::ParseLine(std::string_view line)
 			section = data.emplace(std::string(),
 					       IniSection()).first;
 
-		auto i = section->second.emplace(key, value);
+		auto i = section->second.emplace(key,
+						 IniValue{std::string{value},
+							  line_number});
 		if (!i.second)
 			throw FmtRuntimeError("Duplicate key: {:?}", key);
 	} else
@@ -131,7 +134,7 @@ ReadIniFile(const char *path, BufferedReader &reader)
 
 	while (const char *line = reader.ReadLine()) {
 		try {
-			parser.ParseLine(line);
+			parser.ParseLine(line, reader.GetLineNumber());
 		} catch (...) {
 			std::throw_with_nested(FmtRuntimeError("Error on {:?} line {}",
 							       path, reader.GetLineNumber()));
@@ -7,7 +7,16 @@
 #include <map>
 #include <string>
 
-using IniSection = std::map<std::string, std::string>;
+struct IniValue {
+	std::string value;
+
+	/**
+	 * The line number in the file, for error messages.
+	 */
+	unsigned line;
+};
+
+using IniSection = std::map<std::string, IniValue>;
 using IniFile = std::map<std::string, IniSection>;
 
 IniFile
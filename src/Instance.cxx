@@ -12,20 +12,19 @@
 
 Instance::Instance(const Config &config)
 	:curl_global(event_loop, NullableString(config.proxy)),
-	 mpd_observer(event_loop, *this,
-		      NullableString(config.host), config.port),
-	 scrobblers(config.scrobblers, event_loop, curl_global),
-	 save_journal_interval(std::chrono::seconds{config.journal_interval}),
-	 save_journal_timer(event_loop, BIND_THIS_METHOD(OnSaveJournalTimer))
+	 scrobblers(config.scrobblers, event_loop, curl_global)
 {
+	for (const auto &i : config.mpds)
+		sources.emplace_front(event_loop, i,
+				      scrobblers.Select(i.scrobblers),
+				      std::chrono::milliseconds{config.now_playing_delay});
+
 #ifndef _WIN32
 	SignalMonitorInit(event_loop);
 	SignalMonitorRegister(SIGTERM, BIND_THIS_METHOD(Stop));
 	SignalMonitorRegister(SIGINT, BIND_THIS_METHOD(Stop));
 	SignalMonitorRegister(SIGUSR1, BIND_THIS_METHOD(OnSubmitSignal));
 #endif
-
-	ScheduleSaveJournalTimer();
 }
 
 Instance::~Instance() noexcept
@@ -50,16 +49,3 @@ Instance::OnSubmitSignal() noexcept
 }
 
 #endif
-
-void
-Instance::OnSaveJournalTimer() noexcept
-{
-	scrobblers.WriteJournal();
-	ScheduleSaveJournalTimer();
-}
-
-void
-Instance::ScheduleSaveJournalTimer() noexcept
-{
-	save_journal_timer.Schedule(save_journal_interval);
-}
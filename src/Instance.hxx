@@ -5,27 +5,26 @@
 #define INSTANCE_HXX
 
 #include "event/Loop.hxx"
-#include "event/CoarseTimerEvent.hxx"
 #include "lib/curl/Global.hxx"
-#include "time/Stopwatch.hxx"
-#include "MpdObserver.hxx"
+#include "MpdSource.hxx"
 #include "MultiScrobbler.hxx"
 
+#include <forward_list>
+
 struct Config;
 
-struct Instance final : MpdObserverListener {
+struct Instance final {
 	EventLoop event_loop;
 
-	Stopwatch stopwatch;
-
 	CurlGlobal curl_global;
 
-	MpdObserver mpd_observer;
-
 	MultiScrobbler scrobblers;
 
-	const Event::Duration save_journal_interval;
-	CoarseTimerEvent save_journal_timer;
+	/**
+	 * One for each configured MPD; they all share #event_loop,
+	 * #curl_global and #scrobblers.
+	 */
+	std::forward_list<MpdSource> sources;
 
 	Instance(const Config &config);
 	~Instance() noexcept;
@@ -36,24 +35,10 @@ struct Instance final : MpdObserverListener {
 
 	void Stop() noexcept;
 
-	void OnMpdSongChanged(const struct mpd_song *song) noexcept;
-
-	/* virtual methods from MpdObserverListener */
-	void OnMpdStarted(const struct mpd_song *song) noexcept override;
-	void OnMpdPlaying(const struct mpd_song *song,
-			  std::chrono::steady_clock::duration elapsed) noexcept override;
-	void OnMpdEnded(const struct mpd_song *song,
-			bool love) noexcept override;
-	void OnMpdPaused() noexcept override;
-	void OnMpdResumed() noexcept override;
-
 private:
 #ifndef _WIN32
 	void OnSubmitSignal() noexcept;
 #endif
-
-	void OnSaveJournalTimer() noexcept;
-	void ScheduleSaveJournalTimer() noexcept;
 };
 
 #endif
@@ -2,147 +2,451 @@
 // Copyright The Music Player Daemon Project
 
 #include "Journal.hxx"
-#include "Record.hxx"
+#include "BinaryJournal.hxx"
+#include "TextJournal.hxx"
+#include "JournalBacklog.hxx"
+#include "RecordSpill.hxx"
 #include "lib/fmt/ExceptionFormatter.hxx"
-#include "io/BufferedReader.hxx"
-#include "io/FileReader.hxx"
+#include "io/FileMapping.hxx"
+#include "event/WakeFD.hxx"
 #include "system/Error.hxx"
-#include "util/StringStrip.hxx"
+#include "util/SpanCast.hxx"
 #include "Log.hxx"
 
 #include <fmt/core.h>
 
+#include <algorithm> // for std::max()
+#include <atomic>
 #include <cassert>
+#include <mutex>
+#include <thread>
 
-#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 
-static int journal_file_empty;
+#ifdef _WIN32
+#include <io.h> // for _commit()
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Write the data to the file and flush it to disk.
+ *
+ * @return false on error (with errno set)
+ */
+static bool
+WriteAndSync(FILE *file, std::string_view data) noexcept
+{
+	return fwrite(data.data(), 1, data.size(), file) == data.size() &&
+		fflush(file) == 0 &&
+#ifdef _WIN32
+		_commit(_fileno(file)) == 0;
+#else
+		fsync(fileno(file)) == 0;
+#endif
+}
 
-static void
-journal_write_string(FILE *file, char field, const char *value)
+/**
+ * Replace the file atomically with the given contents: write them
+ * to a temporary file, flush it to disk and rename it.  This runs
+ * in a worker thread, so it does not log; errors are returned as a
+ * message.
+ *
+ * Before the rename, the tail (entries which were written in the
+ * meantime) is appended while holding the mutex, and "replaced" is
+ * set after the rename, so every entry is either in the new file or
+ * it is written after the old one has been replaced.
+ *
+ * @return an empty string on success
+ */
+static std::string
+ReplaceFile(const std::string &path, std::string_view contents,
+	    std::mutex &mutex, const std::string &tail,
+	    bool &replaced) noexcept
 {
-	if (value != nullptr)
-		fmt::print(file, "{} = {}\n", field, value);
+	const std::string tmp = path + ".tmp";
+
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (file == nullptr)
+		return fmt::format("Failed to create {:?}: {}",
+				   tmp, strerror(errno));
+
+	if (!WriteAndSync(file, contents)) {
+		const int e = errno;
+		fclose(file);
+		remove(tmp.c_str());
+		return fmt::format("Failed to write {:?}: {}",
+				   tmp, strerror(e));
+	}
+
+	{
+		/* Journal::Write() waits while the tail is being
+		   written, which is short compared to the rest */
+		const std::scoped_lock lock{mutex};
+
+		if (!WriteAndSync(file, tail)) {
+			const int e = errno;
+			fclose(file);
+			remove(tmp.c_str());
+			return fmt::format("Failed to write {:?}: {}",
+					   tmp, strerror(e));
+		}
+
+		fclose(file);
+
+#ifdef _WIN32
+		/* rename() does not replace existing files on
+		   Windows */
+		remove(path.c_str());
+#endif
+
+		if (rename(tmp.c_str(), path.c_str()) != 0) {
+			const int e = errno;
+			remove(tmp.c_str());
+			return fmt::format("Failed to rename {:?}: {}",
+					   tmp, strerror(e));
+		}
+
+		replaced = true;
+	}
+
+#ifndef _WIN32
+	/* make the rename durable */
+	const auto slash = path.rfind('/');
+	const std::string directory = slash == path.npos
+		? std::string{"."}
+		: path.substr(0, std::max<std::size_t>(slash, 1));
+	if (int fd = open(directory.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	    fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+#endif
+
+	return {};
 }
 
-static void
-journal_write_string(FILE *file, char field, const std::string &value)
+struct Journal::Compaction {
+	std::thread thread;
+
+	/**
+	 * Written by the worker thread when it has finished.
+	 */
+	WakeFD wake;
+
+	/**
+	 * Set by the worker thread when it has finished.
+	 */
+	std::atomic_bool done{false};
+
+	/**
+	 * The error message of the worker thread (empty on success).
+	 * It may only be accessed after #done has been set.
+	 */
+	std::string error;
+
+	/**
+	 * Protects #tail and #replaced.
+	 */
+	std::mutex mutex;
+
+	/**
+	 * Entries which were written after the compaction was
+	 * started.  They are missing in the contents and are
+	 * appended to the new file by the worker thread.
+	 */
+	std::string tail;
+
+	/**
+	 * Has the new file replaced the old one?  After that,
+	 * entries must not be added to #tail anymore; they must be
+	 * written to the new file.
+	 */
+	bool replaced = false;
+
+	/**
+	 * Journal::n_acked when the compaction was started.
+	 */
+	unsigned n_acked;
+
+	Compaction(const std::string &path, std::string &&contents,
+		   unsigned _n_acked)
+		:n_acked(_n_acked)
+	{
+		thread = std::thread([this, path, contents=std::move(contents)](){
+			error = ReplaceFile(path, contents,
+					    mutex, tail, replaced);
+			done.store(true, std::memory_order_release);
+			wake.Write();
+		});
+	}
+
+	~Compaction() noexcept {
+		if (thread.joinable())
+			thread.join();
+	}
+
+	/**
+	 * Add an entry to #tail unless the old file has already been
+	 * replaced.
+	 *
+	 * @return false if the old file has been replaced
+	 */
+	bool AddToTail(std::string_view entry) noexcept {
+		const std::scoped_lock lock{mutex};
+		if (replaced)
+			return false;
+
+		tail.append(entry);
+		return true;
+	}
+};
+
+Journal::Journal(EventLoop &event_loop,
+		 std::string_view _path, JournalFormat _format) noexcept
+	:path(_path), format(_format),
+	 compaction_event(event_loop, BIND_THIS_METHOD(OnCompactionDone)) {}
+
+Journal::~Journal() noexcept
 {
-	if (!value.empty())
-		fmt::print(file, "{} = {}\n", field, value);
+	CheckCompaction(true);
+	Close();
+
+	if (!unwritten.empty())
+		FmtError("Failed to save {:?}: lost {} bytes of entries because it could not be converted",
+			 path, unwritten.size());
 }
 
-static void
-journal_write_record(FILE *file, const Record *record)
+inline void
+Journal::Close() noexcept
 {
-	assert(record->source != nullptr);
-
-	journal_write_string(file, 'a', record->artist);
-	journal_write_string(file, 't', record->track);
-	journal_write_string(file, 'b', record->album);
-	journal_write_string(file, 'n', record->number);
-	journal_write_string(file, 'm', record->mbid);
-	if (record->love)
-		journal_write_string(file, 'r', "L");
-	journal_write_string(file, 'i', record->time);
-
-	const auto length_s =
-		std::chrono::duration_cast<std::chrono::seconds>(record->length);
-
-	fmt::print(file, "l = {}\no = {}\n\n",
-		   length_s.count(),
-		   record->source);
+	if (file != nullptr) {
+		fclose(file);
+		file = nullptr;
+	}
 }
 
 bool
-journal_write(const char *path, const std::list<Record> &queue)
+Journal::OpenAppend() noexcept
 {
-	FILE *handle;
+	if (file != nullptr)
+		return true;
 
-	if (queue.empty() && journal_file_empty)
+	if (convert)
+		/* the file must be converted by Compact() first */
 		return false;
 
-	handle = fopen(path, "wb");
-	if (!handle) {
-		FmtError("Failed to save {:?}: {}", path, strerror(errno));
+	file = fopen(path.c_str(), "ab");
+	if (file == nullptr) {
+		FmtError("Failed to open {:?}: {}", path, strerror(errno));
 		return false;
 	}
 
+	if (format == JournalFormat::BINARY &&
+	    fseek(file, 0, SEEK_END) == 0 && ftell(file) == 0) {
+		/* this is a new file */
+		std::string header;
+		binary_journal_encode_header(header);
+		fwrite(header.data(), 1, header.size(), file);
+	}
+
+	return true;
+}
+
+void
+Journal::Write(std::string_view entry) noexcept
+{
+	CheckCompaction();
+
+	++generation;
+
+	if (compaction) {
+		if (!compaction->AddToTail(entry))
+			/* too late for the new file: switch to it
+			   and append there */
+			CheckCompaction(true);
+	} else if (convert)
+		/* keep it until a conversion succeeds */
+		unwritten.append(entry);
+
+	if (!OpenAppend())
+		return;
+
+	fwrite(entry.data(), 1, entry.size(), file);
+
+	/* flush immediately so the entry survives a crash */
+	fflush(file);
+}
+
+void
+Journal::Append(const Record &record) noexcept
+{
+	std::string entry;
+	if (format == JournalFormat::BINARY)
+		binary_journal_encode_record(entry, record);
+	else
+		text_journal_encode_record(entry, record);
+
+	Write(entry);
+}
+
+void
+Journal::Acknowledge(unsigned n) noexcept
+{
+	assert(n > 0);
+
+	std::string entry;
+	if (format == JournalFormat::BINARY)
+		binary_journal_encode_ack(entry, n);
+	else
+		text_journal_encode_ack(entry, n);
+
+	Write(entry);
+
+	n_acked += n;
+}
+
+bool
+Journal::Compact(const RecordQueue &queue, const JournalBacklog *backlog,
+		 const RecordSpill *spill) noexcept
+{
+	CheckCompaction();
+	if (compaction)
+		return false;
+
+	/* the whole file is encoded here, because the records must
+	   not be accessed from the worker thread */
+	std::string contents;
+
+	const auto write = [this, &contents](const Record &record){
+		if (format == JournalFormat::BINARY)
+			binary_journal_encode_record(contents, record);
+		else
+			text_journal_encode_record(contents, record);
+	};
+
+	if (format == JournalFormat::BINARY)
+		binary_journal_encode_header(contents);
+
 	for (const auto &i : queue)
-		journal_write_record(handle, &i);
+		write(*i);
+
+	if (backlog != nullptr)
+		backlog->ForEach(write);
 
-	fclose(handle);
+	if (spill != nullptr)
+		spill->ForEach(write);
 
+	return Replace(std::move(contents));
+}
+
+bool
+Journal::Replace(std::string &&contents) noexcept
+{
+	CheckCompaction();
+	if (compaction)
+		return false;
+
+	try {
+		compaction = std::make_unique<Compaction>(path,
+							  std::move(contents),
+							  n_acked);
+	} catch (...) {
+		FmtError("Failed to save {:?}: {}",
+			 path, std::current_exception());
+		return false;
+	}
+
+	/* the new contents include everything which could not be
+	   written before */
+	unwritten.clear();
+
+	compaction_event.Open(compaction->wake.GetSocket());
+	compaction_event.ScheduleRead();
 	return true;
 }
 
-static void
-journal_commit_record(std::list<Record> &queue, Record &&record)
+void
+Journal::CheckCompaction(bool wait) noexcept
 {
-	if (!record.artist.empty() && !record.track.empty()) {
-		/* append record to the queue */
+	if (!compaction ||
+	    (!wait && !compaction->done.load(std::memory_order_acquire)))
+		return;
+
+	compaction_event.ReleaseSocket();
+
+	const auto c = std::move(compaction);
+	c->thread.join();
+
+	if (!c->error.empty()) {
+		FmtError("Failed to save {:?}: {}", path, c->error);
 
-		queue.emplace_back(std::move(record));
+		if (convert)
+			/* the old file could not be appended to;
+			   keep the tail until the next attempt to
+			   convert it */
+			unwritten = std::move(c->tail);
 
-		journal_file_empty = false;
+		/* else: the old file is still intact, and the tail
+		   has been appended to it */
+		return;
 	}
+
+	/* switch to the new file, which already contains the
+	   tail */
+	Close();
+	convert = false;
+	n_acked -= c->n_acked;
+}
+
+void
+Journal::OnCompactionDone(unsigned) noexcept
+{
+	/* close the old file and report errors right away, not
+	   only with the next entry */
+	CheckCompaction();
 }
 
-std::list<Record>
-journal_read(const char *path)
+void
+Journal::WaitCompaction() noexcept
+{
+	CheckCompaction(true);
+}
+
+JournalBacklog
+Journal::Read()
 try {
-	FileReader file{path};
-	BufferedReader reader{file};
-
-	Record record;
-
-	journal_file_empty = true;
-
-	std::list<Record> queue;
-	while (char *line = reader.ReadLine()) {
-		char *key, *value;
-
-		key = StripLeft(line);
-		if (*key == 0 || *key == '#')
-			continue;
-
-		value = strchr(key, '=');
-		if (value == nullptr || value == key)
-			continue;
-
-		*value++ = 0;
-
-		StripRight(key);
-		value = Strip(value);
-
-		if (!strcmp("a", key)) {
-			journal_commit_record(queue, std::move(record));
-			record = {};
-			record.artist = value;
-		} else if (!strcmp("t", key))
-			record.track = value;
-		else if (!strcmp("b", key))
-			record.album = value;
-		else if (!strcmp("n", key))
-			record.number = value;
-		else if (!strcmp("m", key))
-			record.mbid = value;
-		else if (!strcmp("i", key))
-			record.time = value;
-		else if (!strcmp("l", key))
-			record.length = std::chrono::seconds(atoi(value));
-		else if (strcmp("o", key) == 0 && value[0] == 'R')
-			record.source = "R";
-		else if (strcmp("r", key) == 0 && value[0] == 'L')
-			record.love = true;
+	/* a compaction may still be writing the file */
+	CheckCompaction(true);
+
+	n_acked = 0;
+	convert = false;
+
+	auto mapping = std::make_unique<FileMapping>(path.c_str());
+	const auto src = mapping->get();
+	if (src.empty())
+		return {};
+
+	std::deque<std::size_t> offsets;
+
+	const bool binary = binary_journal_check_header(src);
+	if (binary) {
+		bool complete;
+		binary_journal_index(path.c_str(), src, offsets,
+				     n_acked, complete);
+
+		/* rewrite the file if it was corrupt, or else new
+		   frames would be appended after the garbage */
+		convert = !complete || format != JournalFormat::BINARY;
+	} else {
+		text_journal_index(ToStringView(src), offsets, n_acked);
+		convert = format != JournalFormat::TEXT;
 	}
 
-	journal_commit_record(queue, std::move(record));
-
-	return queue;
+	return {std::move(mapping), binary, std::move(offsets)};
 } catch (const std::system_error &e) {
 	if (!IsFileNotFound(e))
 		/* ENOENT is ignored silently, because the user might
@@ -4,14 +4,189 @@
 #ifndef JOURNAL_HXX
 #define JOURNAL_HXX
 
-#include <list>
+#include "JournalFormat.hxx"
+#include "ScrobblerJournal.hxx"
+#include "event/SocketEvent.hxx"
 
-struct Record;
+#include <memory>
+#include <string>
 
-bool
-journal_write(const char *path, const std::list<Record> &queue);
+#include <stdio.h>
 
-std::list<Record>
-journal_read(const char *path);
+/**
+ * An append-only log of records which have not been submitted yet.
+ * Each new record is appended to the file as soon as it gets queued,
+ * and each successful submission appends an "ack" entry which
+ * removes the oldest records.  The file is rewritten ("compacted")
+ * only after enough records have been acknowledged.
+ *
+ * Compaction runs in a worker thread, so the #EventLoop does not
+ * block on disk I/O: the new contents are written to a temporary
+ * file, flushed to disk with fsync() and then renamed over the old
+ * file, so a crash never leaves a partially written journal.
+ * Entries which are written in the meantime are appended to the
+ * temporary file before it is renamed, so the new file contains
+ * everything written until then.  When the worker thread has
+ * finished, it wakes up the #EventLoop, which switches to the new
+ * file right away.
+ */
+class Journal final : public ScrobblerJournal {
+	/**
+	 * Compact the journal after this many records have been
+	 * acknowledged.
+	 */
+	static constexpr unsigned COMPACT_THRESHOLD = 256;
+
+	const std::string path;
+
+	/**
+	 * The format used for writing.  The reader detects the
+	 * format automatically.
+	 */
+	const JournalFormat format;
+
+	/**
+	 * The file opened for appending.  It is opened lazily by
+	 * OpenAppend().
+	 */
+	FILE *file = nullptr;
+
+	/**
+	 * The number of acknowledged records which are still in the
+	 * file.
+	 */
+	unsigned n_acked = 0;
+
+	/**
+	 * Incremented each time an entry is written.  This allows
+	 * callers to skip journals which have not changed.
+	 */
+	unsigned generation = 0;
+
+	/**
+	 * Was the file found in a different format than #format?
+	 * Then it needs to be converted by Compact() before new
+	 * entries may be appended.
+	 */
+	bool convert = false;
+
+	struct Compaction;
+
+	/**
+	 * The compaction which is currently running in a worker
+	 * thread, or nullptr if there is none.
+	 */
+	std::unique_ptr<Compaction> compaction;
+
+	/**
+	 * Waits for the worker thread of #compaction to finish.
+	 */
+	SocketEvent compaction_event;
+
+	/**
+	 * Entries which could not be appended to the file, because
+	 * it has not been converted yet (see #convert).  They are
+	 * kept until a new compaction supersedes them.
+	 */
+	std::string unwritten;
+
+public:
+	Journal(EventLoop &event_loop,
+		std::string_view _path, JournalFormat _format) noexcept;
+
+	~Journal() noexcept;
+
+	Journal(const Journal &) = delete;
+	Journal &operator=(const Journal &) = delete;
+
+	/**
+	 * Write an encoded entry to the file (and to the running
+	 * compaction).
+	 */
+	void Write(std::string_view entry) noexcept;
+
+	/**
+	 * Start replacing the file with the given (encoded)
+	 * contents in a worker thread.  Entries which are written in
+	 * the meantime are appended to the new file before it
+	 * replaces the old one.
+	 *
+	 * @return true if the compaction has been started; false if
+	 * another one is still running
+	 */
+	bool Replace(std::string &&contents) noexcept;
+
+	/**
+	 * Is a compaction running in a worker thread?
+	 */
+	bool IsCompacting() noexcept {
+		CheckCompaction();
+		return compaction != nullptr;
+	}
+
+	/* virtual methods from class ScrobblerJournal */
+	const std::string &GetPath() const noexcept override {
+		return path;
+	}
+
+	/**
+	 * Replay the journal file and return all records which have
+	 * not been acknowledged.
+	 */
+	JournalBacklog Read() override;
+
+	void Append(const Record &record) noexcept override;
+	void Acknowledge(unsigned n) noexcept override;
+
+	unsigned GetGeneration() const noexcept override {
+		return generation;
+	}
+
+	/**
+	 * @param eager compact as soon as there is at least one
+	 * acknowledged record, instead of waiting for enough to
+	 * accumulate
+	 */
+	bool NeedsCompaction(bool eager=false) const noexcept override {
+		return convert || n_acked >= (eager ? 1 : COMPACT_THRESHOLD);
+	}
+
+	/**
+	 * Start rewriting the journal file with only the given
+	 * records, dropping all acknowledged records.  The records
+	 * are encoded right away, but the file is written by a
+	 * worker thread.  Entries which are appended in the meantime
+	 * are copied to the new file before it replaces the old
+	 * one.
+	 *
+	 * @param backlog records which follow the ones in #queue
+	 * (optional)
+	 * @param spill records which follow the ones in #backlog
+	 * (optional)
+	 * @return true if the compaction has been started; false if
+	 * another one is still running
+	 */
+	bool Compact(const RecordQueue &queue,
+		     const JournalBacklog *backlog=nullptr,
+		     const RecordSpill *spill=nullptr) noexcept override;
+
+	/**
+	 * Wait for the running compaction (if any) to finish.
+	 */
+	void WaitCompaction() noexcept;
+
+private:
+	/**
+	 * If the compaction has finished, switch to the new file.
+	 *
+	 * @param wait wait for the compaction to finish?
+	 */
+	void CheckCompaction(bool wait=false) noexcept;
+
+	void OnCompactionDone(unsigned events) noexcept;
+
+	bool OpenAppend() noexcept;
+	void Close() noexcept;
+};
 
 #endif
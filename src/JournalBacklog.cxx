@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "JournalBacklog.hxx"
+#include "BinaryJournal.hxx"
+#include "TextJournal.hxx"
+#include "util/SpanCast.hxx"
+#include "Log.hxx"
+
+#include <algorithm> // for std::min()
+
+bool
+JournalBacklog::Decode(std::size_t offset, RecordQueue &queue) const noexcept
+{
+	const auto src = mapping->get();
+	return binary
+		? binary_journal_decode(src, offset, queue)
+		: text_journal_decode(ToStringView(src), offset, queue);
+}
+
+std::size_t
+JournalBacklog::Pop(RecordQueue &queue, std::size_t max) noexcept
+{
+	max = std::min(max, offsets.size());
+
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < max; ++i) {
+		if (Decode(offsets[i], queue))
+			++n;
+		else
+			FmtWarning("Failed to decode journal record at offset {}",
+				   offsets[i]);
+	}
+
+	RemoveOldest(offsets, max);
+
+	if (offsets.empty())
+		/* everything has been decoded; release the file */
+		mapping.reset();
+
+	return n;
+}
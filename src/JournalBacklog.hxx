@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef JOURNAL_BACKLOG_HXX
+#define JOURNAL_BACKLOG_HXX
+
+#include "RecordQueue.hxx"
+#include "io/FileMapping.hxx"
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+
+/**
+ * The records of a journal file which have not been submitted yet,
+ * without decoding them: only their offsets within the (mapped)
+ * file are kept.  They are decoded on demand, oldest first, so
+ * loading a large journal neither takes long nor needs much memory.
+ *
+ * The file must not be modified in place while this object refers
+ * to it; Journal::Compact() therefore replaces it with a new file.
+ */
+class JournalBacklog {
+	/**
+	 * The mapped file.  It may be shared with other instances
+	 * (see #SharedJournal).
+	 */
+	std::shared_ptr<const FileMapping> mapping;
+
+	/**
+	 * The offsets of the records within #mapping, oldest first.
+	 */
+	std::deque<std::size_t> offsets;
+
+	/**
+	 * Is the file in the binary format?
+	 */
+	bool binary = false;
+
+public:
+	JournalBacklog() noexcept = default;
+
+	JournalBacklog(std::shared_ptr<const FileMapping> _mapping, bool _binary,
+		       std::deque<std::size_t> &&_offsets) noexcept
+		:mapping(std::move(_mapping)), offsets(std::move(_offsets)),
+		 binary(_binary) {}
+
+	JournalBacklog(JournalBacklog &&) noexcept = default;
+	JournalBacklog &operator=(JournalBacklog &&) noexcept = default;
+
+	bool empty() const noexcept {
+		return offsets.empty();
+	}
+
+	std::size_t size() const noexcept {
+		return offsets.size();
+	}
+
+	/**
+	 * Decode up to the given number of (the oldest) records and
+	 * move them to the end of the queue.
+	 *
+	 * @return the number of records appended to the queue
+	 */
+	std::size_t Pop(RecordQueue &queue, std::size_t max) noexcept;
+
+	/**
+	 * Invoke the given function for each record (oldest first),
+	 * without removing them.  Only one record is decoded at a
+	 * time.
+	 */
+	template<typename F>
+	void ForEach(F &&f) const noexcept {
+		RecordQueue tmp;
+		for (const std::size_t offset : offsets) {
+			if (Decode(offset, tmp)) {
+				f(*tmp.front());
+				tmp.clear();
+			}
+		}
+	}
+
+private:
+	bool Decode(std::size_t offset, RecordQueue &queue) const noexcept;
+};
+
+#endif
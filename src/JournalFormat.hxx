@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef JOURNAL_FORMAT_HXX
+#define JOURNAL_FORMAT_HXX
+
+#include <cstdint>
+
+enum class JournalFormat : uint_least8_t {
+	/**
+	 * The traditional "key = value" text format.
+	 */
+	TEXT,
+
+	/**
+	 * A versioned binary format with length-prefixed and
+	 * checksummed frames, see BinaryJournal.hxx.
+	 */
+	BINARY,
+};
+
+#endif
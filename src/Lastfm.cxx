@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "Lastfm.hxx"
+#include "Protocol.hxx"
+#include "Form.hxx"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <charconv>
+
+namespace Lastfm {
+
+Call::Call(std::string_view method, std::string_view api_key) noexcept
+{
+	params.emplace_back("method", method);
+	params.emplace_back("api_key", api_key);
+}
+
+void
+Call::Add(std::string_view name, std::string_view value) noexcept
+{
+	if (!value.empty())
+		params.emplace_back(name, value);
+}
+
+void
+Call::Add(std::string_view name, int_least64_t value) noexcept
+{
+	params.emplace_back(name, fmt::format_int{value}.c_str());
+}
+
+void
+Call::AddIndexed(std::string_view name, unsigned idx,
+		 std::string_view value) noexcept
+{
+	if (!value.empty())
+		params.emplace_back(fmt::format("{}[{}]", name, idx), value);
+}
+
+void
+Call::AddIndexed(std::string_view name, unsigned idx,
+		 int_least64_t value) noexcept
+{
+	params.emplace_back(fmt::format("{}[{}]", name, idx),
+			    fmt::format_int{value}.c_str());
+}
+
+std::string
+Call::Finish(std::string_view api_secret) && noexcept
+{
+	/* the signature is the MD5 of all parameters (sorted by
+	   name) concatenated without separators, followed by the
+	   secret */
+	std::ranges::sort(params, {}, &decltype(params)::value_type::first);
+
+	std::string sig_input;
+	for (const auto &[name, value] : params) {
+		sig_input.append(name);
+		sig_input.append(value);
+	}
+
+	sig_input.append(api_secret);
+
+	const auto sig = md5_hex(sig_input);
+
+	FormDataBuilder body;
+	for (const auto &[name, value] : params)
+		body.Append(name, value);
+
+	body.Append("api_sig", sig);
+	return body;
+}
+
+/**
+ * Find the start tag of the given element.
+ *
+ * @return the attributes of the start tag (everything between the
+ * element name and the closing '>'), or a null string_view if the
+ * element was not found
+ */
+static std::string_view
+FindStartTag(std::string_view body, std::string_view name) noexcept
+{
+	for (std::size_t pos = 0;
+	     (pos = body.find('<', pos)) != body.npos;
+	     ++pos) {
+		auto rest = body.substr(pos + 1);
+		if (!rest.starts_with(name))
+			continue;
+
+		rest = rest.substr(name.size());
+		if (rest.empty() ||
+		    (rest.front() != '>' && rest.front() != ' ' &&
+		     rest.front() != '/'))
+			continue;
+
+		const auto end = rest.find('>');
+		if (end == rest.npos)
+			break;
+
+		return rest.substr(0, end);
+	}
+
+	return {};
+}
+
+std::string_view
+FindAttribute(std::string_view body, std::string_view element,
+	      std::string_view attribute) noexcept
+{
+	const auto tag = FindStartTag(body, element);
+
+	for (std::size_t pos = 0;
+	     (pos = tag.find(attribute, pos)) != tag.npos;
+	     ++pos) {
+		if (pos == 0 || tag[pos - 1] != ' ')
+			continue;
+
+		auto rest = tag.substr(pos + attribute.size());
+		if (!rest.starts_with("=\""))
+			continue;
+
+		rest = rest.substr(2);
+		const auto end = rest.find('"');
+		if (end == rest.npos)
+			break;
+
+		return rest.substr(0, end);
+	}
+
+	return {};
+}
+
+std::string_view
+FindElement(std::string_view body, std::string_view name) noexcept
+{
+	const auto tag = FindStartTag(body, name);
+	if (tag.data() == nullptr || tag.ends_with('/'))
+		return {};
+
+	/* skip the closing '>' of the start tag */
+	const auto content = body.substr(tag.data() + tag.size() + 1 - body.data());
+
+	const auto end_tag = fmt::format("</{}>", name);
+	const auto end = content.find(end_tag);
+	if (end == content.npos)
+		return {};
+
+	return content.substr(0, end);
+}
+
+Response
+ParseResponse(std::string_view body) noexcept
+{
+	const auto status = FindAttribute(body, "lfm", "status");
+	if (status == "ok")
+		return {true, 0, {}};
+
+	const auto code = FindAttribute(body, "error", "code");
+
+	unsigned error = 0;
+	if (status != "failed" ||
+	    std::from_chars(code.data(), code.data() + code.size(),
+			    error).ec != std::errc{})
+		return {false, 0, "malformed response"};
+
+	return {false, error, FindElement(body, "error")};
+}
+
+} // namespace Lastfm
@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef LASTFM_HXX
+#define LASTFM_HXX
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+ * Helpers for the Last.fm 2.0 web service API.
+ */
+namespace Lastfm {
+
+static constexpr char DEFAULT_URL[] = "https://ws.audioscrobbler.com/2.0/";
+
+/**
+ * The "track.scrobble" method accepts up to this number of tracks
+ * in one request.
+ */
+static constexpr unsigned MAX_SCROBBLES = 50;
+
+/**
+ * Error codes returned by the API (only the ones mpdscribble cares
+ * about).
+ */
+enum Error : unsigned {
+	INVALID_SESSION_KEY = 9,
+	SERVICE_OFFLINE = 11,
+	TEMPORARILY_UNAVAILABLE = 16,
+	RATE_LIMIT_EXCEEDED = 29,
+};
+
+/**
+ * Builds the POST body of a signed API call.
+ */
+class Call {
+	std::vector<std::pair<std::string, std::string>> params;
+
+public:
+	Call(std::string_view method, std::string_view api_key) noexcept;
+
+	/**
+	 * Add a parameter; empty values are omitted.
+	 */
+	void Add(std::string_view name, std::string_view value) noexcept;
+	void Add(std::string_view name, int_least64_t value) noexcept;
+
+	void AddIndexed(std::string_view name, unsigned idx,
+			std::string_view value) noexcept;
+	void AddIndexed(std::string_view name, unsigned idx,
+			int_least64_t value) noexcept;
+
+	/**
+	 * Calculate the "api_sig" parameter and return the
+	 * "application/x-www-form-urlencoded" request body.
+	 */
+	std::string Finish(std::string_view api_secret) && noexcept;
+};
+
+struct Response {
+	/**
+	 * Did the server report success?
+	 */
+	bool ok;
+
+	/**
+	 * The API error code, or 0 if the response was malformed.
+	 */
+	unsigned error;
+
+	/**
+	 * The error message (if #error is non-zero).
+	 */
+	std::string_view message;
+};
+
+/**
+ * Parse the "<lfm status=...>" envelope of an XML response.
+ */
+[[gnu::pure]]
+Response
+ParseResponse(std::string_view body) noexcept;
+
+/**
+ * Find the first XML element with the given name and return its
+ * text content.  This is not a real XML parser, but it is good
+ * enough for the simple documents returned by the API.
+ *
+ * @return the raw (not unescaped) text or an empty string if the
+ * element was not found
+ */
+[[gnu::pure]]
+std::string_view
+FindElement(std::string_view body, std::string_view name) noexcept;
+
+/**
+ * Find an attribute of the first XML element with the given name.
+ */
+[[gnu::pure]]
+std::string_view
+FindAttribute(std::string_view body, std::string_view element,
+	      std::string_view attribute) noexcept;
+
+} // namespace Lastfm
+
+#endif
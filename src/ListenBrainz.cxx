@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "ListenBrainz.hxx"
+#include "Protocol.hxx"
+#include "Record.hxx"
+
+#include <fmt/format.h>
+
+#include <iterator> // for std::back_inserter
+
+namespace ListenBrainz {
+
+std::string
+MakeSubmitUrl(std::string_view root) noexcept
+{
+	std::string url{root};
+	if (!url.ends_with('/'))
+		url.push_back('/');
+	url.append("1/submit-listens");
+	return url;
+}
+
+/**
+ * Append a JSON string literal.
+ */
+static void
+AppendString(std::string &json, std::string_view value) noexcept
+{
+	json.push_back('"');
+
+	for (const char ch : value) {
+		switch (ch) {
+		case '"':
+			json.append("\\\"");
+			break;
+
+		case '\\':
+			json.append("\\\\");
+			break;
+
+		case '\n':
+			json.append("\\n");
+			break;
+
+		case '\t':
+			json.append("\\t");
+			break;
+
+		default:
+			if ((unsigned char)ch < 0x20)
+				fmt::format_to(std::back_inserter(json),
+					       "\\u{:04x}", (unsigned)ch);
+			else
+				json.push_back(ch);
+		}
+	}
+
+	json.push_back('"');
+}
+
+/**
+ * Append a member with a string value (preceded by a comma).
+ */
+static void
+AppendMember(std::string &json, std::string_view name,
+	     std::string_view value) noexcept
+{
+	json.push_back(',');
+	AppendString(json, name);
+	json.push_back(':');
+	AppendString(json, value);
+}
+
+Submission::Submission(std::string_view listen_type) noexcept
+	:playing_now(listen_type == "playing_now")
+{
+	json = "{\"listen_type\":";
+	AppendString(json, listen_type);
+	json.append(",\"payload\":[");
+}
+
+void
+Submission::Add(const Record &record) noexcept
+{
+	if (!empty)
+		json.push_back(',');
+	empty = false;
+
+	json.push_back('{');
+
+	if (!playing_now)
+		fmt::format_to(std::back_inserter(json),
+			       "\"listened_at\":{},", record.GetTimestamp());
+
+	json.append("\"track_metadata\":{\"artist_name\":");
+	AppendString(json, record.GetArtist());
+	json.append(",\"track_name\":");
+	AppendString(json, record.GetTrack());
+
+	if (!record.GetAlbum().empty())
+		AppendMember(json, "release_name", record.GetAlbum());
+
+	json.append(",\"additional_info\":{\"submission_client\":\"mpdscribble\"");
+	AppendMember(json, "submission_client_version", VERSION);
+
+	if (record.GetLength().count() > 0)
+		fmt::format_to(std::back_inserter(json), ",\"duration\":{}",
+			       record.GetLength().count());
+
+	if (!record.GetNumber().empty())
+		AppendMember(json, "tracknumber", record.GetNumber());
+
+	if (!record.GetMbid().empty())
+		AppendMember(json, "recording_mbid", record.GetMbid());
+
+	json.append("}}}");
+}
+
+std::string
+Submission::Finish() && noexcept
+{
+	json.append("]}");
+	return std::move(json);
+}
+
+std::string_view
+FindErrorMessage(std::string_view body) noexcept
+{
+	auto i = body.find("\"error\"");
+	if (i == body.npos)
+		return {};
+
+	body = body.substr(i + 7);
+	i = body.find('"');
+	if (i == body.npos)
+		return {};
+
+	body = body.substr(i + 1);
+
+	/* find the closing quote, skipping escaped characters */
+	for (i = 0; i < body.size(); ++i) {
+		if (body[i] == '\\')
+			++i;
+		else if (body[i] == '"')
+			return body.substr(0, i);
+	}
+
+	return {};
+}
+
+} // namespace ListenBrainz
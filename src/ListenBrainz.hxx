@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef LISTENBRAINZ_HXX
+#define LISTENBRAINZ_HXX
+
+#include <string>
+#include <string_view>
+
+class Record;
+
+/*
+ * Helpers for the ListenBrainz JSON API.
+ */
+namespace ListenBrainz {
+
+static constexpr char DEFAULT_URL[] = "https://api.listenbrainz.org/";
+
+/**
+ * The server accepts up to this number of listens in one
+ * submission.
+ */
+static constexpr unsigned MAX_LISTENS = 1000;
+
+/**
+ * Build the "submit-listens" URL from the API root URL.
+ */
+std::string
+MakeSubmitUrl(std::string_view root) noexcept;
+
+/**
+ * Builds the JSON body of a "submit-listens" request.
+ */
+class Submission {
+	std::string json;
+
+	const bool playing_now;
+
+	bool empty = true;
+
+public:
+	/**
+	 * @param listen_type "single", "import" or "playing_now"
+	 */
+	explicit Submission(std::string_view listen_type) noexcept;
+
+	void Add(const Record &record) noexcept;
+
+	std::string Finish() && noexcept;
+};
+
+/**
+ * Extract the error message from an error response body.
+ *
+ * @return the raw (still escaped) message or an empty string if
+ * none was found
+ */
+[[gnu::pure]]
+std::string_view
+FindErrorMessage(std::string_view body) noexcept;
+
+} // namespace ListenBrainz
+
+#endif
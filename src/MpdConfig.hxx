@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPD_CONFIG_HXX
+#define MPD_CONFIG_HXX
+
+#include <forward_list>
+#include <string>
+
+/**
+ * An MPD server (or partition) observed by mpdscribble: either
+ * configured in a "[mpd:NAME]" section or the default one from the
+ * global "host" and "port" settings.
+ */
+struct MpdConfig {
+	/**
+	 * The part of the section name after "mpd:".  It is used in
+	 * log messages, and it is empty for the default MPD.
+	 */
+	std::string name;
+
+	std::string host;
+
+	unsigned port = 0;
+
+	/**
+	 * The MPD partition to observe.  If empty, the default
+	 * partition is observed.
+	 */
+	std::string partition;
+
+	/**
+	 * The names of the scrobblers which receive the songs played
+	 * by this MPD.  If empty, all scrobblers receive them.
+	 */
+	std::forward_list<std::string> scrobblers;
+};
+
+#endif
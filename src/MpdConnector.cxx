@@ -0,0 +1,675 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "MpdConnector.hxx"
+#include "event/Loop.hxx"
+#include "Log.hxx"
+
+#include <fmt/format.h>
+
+#include <algorithm> // for std::lexicographical_compare()
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <iterator> // for std::size()
+#include <thread>
+#include <utility> // for std::index_sequence
+
+#include <stdio.h>
+
+#ifndef _WIN32
+#include "event/WakeFD.hxx"
+
+#include <cerrno>
+#include <cstddef> // for offsetof()
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/**
+ * The lowest MPD version supported by mpdscribble.
+ */
+static constexpr unsigned MIN_VERSION[3]{0, 16, 0};
+
+/**
+ * The tags used by #MpdSource.  MPD is asked to send only these, to
+ * keep its responses small.
+ */
+static constexpr enum mpd_tag_type tag_types[]{
+	MPD_TAG_ARTIST,
+	MPD_TAG_ALBUM_ARTIST,
+	MPD_TAG_TITLE,
+	MPD_TAG_ALBUM,
+	MPD_TAG_TRACK,
+	MPD_TAG_MUSICBRAINZ_TRACKID,
+};
+
+/**
+ * Send "tagtypes enable" with all of #tag_types.
+ *
+ * @param send mpd_send_command() or mpd_async_send_command()
+ */
+template<typename T, std::size_t... i>
+static bool
+SendEnableTagTypes(bool (*send)(T *, const char *, ...), T *c,
+		   std::index_sequence<i...>) noexcept
+{
+	return send(c, "tagtypes", "enable",
+		    mpd_tag_name(tag_types[i])..., nullptr);
+}
+
+template<typename T>
+static bool
+SendEnableTagTypes(bool (*send)(T *, const char *, ...), T *c) noexcept
+{
+	return SendEnableTagTypes(send, c,
+				  std::make_index_sequence<std::size(tag_types)>());
+}
+
+static std::string
+settings_name(const struct mpd_settings *settings) noexcept
+{
+	const char *host = mpd_settings_get_host(settings);
+	if (host == nullptr)
+		host = "unknown";
+
+	if (host[0] == '/' || host[0] == '@')
+		return host;
+
+	unsigned port = mpd_settings_get_port(settings);
+	if (port == 0 || port == 6600)
+		return host;
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "%s:%u", host, port);
+	return buffer;
+}
+
+[[gnu::pure]]
+static bool
+IsVersionSupported(const unsigned version[3]) noexcept
+{
+	return !std::lexicographical_compare(version, version + 3,
+					     MIN_VERSION, MIN_VERSION + 3);
+}
+
+#ifndef _WIN32
+
+/**
+ * A host name lookup in a worker thread (libmpdclient has no
+ * asynchronous resolver, and getaddrinfo() may block for a long
+ * time).  The object is shared with the thread, which cannot be
+ * canceled; whoever drops the last reference frees the result.
+ */
+struct MpdConnector::Resolver {
+	WakeFD wake;
+
+	const std::string host, service;
+
+	struct addrinfo *result = nullptr;
+	int error = 0;
+
+	/**
+	 * Set by the worker thread after it has stored the result.
+	 */
+	std::atomic_bool done{false};
+
+	Resolver(const char *_host, unsigned port) noexcept
+		:host(_host), service(fmt::format("{}", port)) {}
+
+	~Resolver() noexcept {
+		if (result != nullptr)
+			freeaddrinfo(result);
+	}
+
+	void Run() noexcept {
+		struct addrinfo hints{};
+		hints.ai_flags = AI_ADDRCONFIG;
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		error = getaddrinfo(host.c_str(), service.c_str(),
+				    &hints, &result);
+		done.store(true, std::memory_order_release);
+		wake.Write();
+	}
+};
+
+/**
+ * Create a non-blocking socket and start connecting it.
+ *
+ * @return the socket or -1 on error (with errno set)
+ */
+static int
+StartConnect(int family, const struct sockaddr *address,
+	     socklen_t size) noexcept
+{
+	const int fd = socket(family, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0 ||
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0 ||
+	    (connect(fd, address, size) < 0 && errno != EINPROGRESS)) {
+		const int e = errno;
+		close(fd);
+		errno = e;
+		return -1;
+	}
+
+	return fd;
+}
+
+static constexpr unsigned
+ToAsyncEvents(unsigned flags) noexcept
+{
+	unsigned events = 0;
+	if (flags & SocketEvent::READ)
+		events |= MPD_ASYNC_EVENT_READ;
+	if (flags & SocketEvent::WRITE)
+		events |= MPD_ASYNC_EVENT_WRITE;
+	if (flags & SocketEvent::HANGUP)
+		events |= MPD_ASYNC_EVENT_HUP;
+	if (flags & SocketEvent::ERROR)
+		events |= MPD_ASYNC_EVENT_ERROR;
+	return events;
+}
+
+static constexpr unsigned
+FromAsyncEvents(unsigned events) noexcept
+{
+	unsigned flags = 0;
+	if (events & MPD_ASYNC_EVENT_READ)
+		flags |= SocketEvent::READ;
+	if (events & MPD_ASYNC_EVENT_WRITE)
+		flags |= SocketEvent::WRITE;
+	return flags;
+}
+
+#endif
+
+MpdConnector::MpdConnector(EventLoop &event_loop,
+			   MpdConnectorHandler &_handler,
+			   const char *host, unsigned port,
+			   const char *_partition) noexcept
+	:handler(_handler),
+	 settings(mpd_settings_new(host, port, 0, nullptr, nullptr)),
+	 partition(_partition),
+	 timeout_timer(event_loop, BIND_THIS_METHOD(OnTimeout)),
+	 defer_error(event_loop, BIND_THIS_METHOD(OnDeferredError)),
+#ifdef _WIN32
+	 defer_connected(event_loop, BIND_THIS_METHOD(OnDeferredConnected))
+#else
+	 resolver_event(event_loop, BIND_THIS_METHOD(OnResolved)),
+	 socket(event_loop, BIND_THIS_METHOD(OnSocketReady))
+#endif
+{
+}
+
+MpdConnector::~MpdConnector() noexcept
+{
+#ifdef _WIN32
+	if (connection != nullptr)
+		mpd_connection_free(connection);
+#else
+	/* the worker thread (if any) keeps its own reference */
+	resolver_event.Cancel();
+
+	if (async != nullptr) {
+		/* this closes the socket */
+		mpd_async_free(async);
+		socket.Abandon();
+	} else if (socket.IsDefined())
+		socket.Close();
+
+	if (addresses != nullptr)
+		freeaddrinfo(addresses);
+#endif
+
+	if (settings != nullptr)
+		mpd_settings_free(settings);
+}
+
+void
+MpdConnector::Fail(std::string_view message) noexcept
+{
+	FmtWarning("Failed to connect to mpd at {}: {}",
+		   settings != nullptr ? settings_name(settings) : "unknown",
+		   message);
+
+#ifndef _WIN32
+	resolver_event.Cancel();
+	socket.Cancel();
+#endif
+	timeout_timer.Cancel();
+	defer_error.Schedule();
+}
+
+void
+MpdConnector::OnDeferredError() noexcept
+{
+	handler.OnMpdConnectError();
+}
+
+void
+MpdConnector::OnTimeout() noexcept
+{
+	Fail("timeout");
+}
+
+#ifdef _WIN32
+
+/* no non-blocking connect on Windows; libmpdclient connects
+   synchronously */
+
+void
+MpdConnector::Start() noexcept
+{
+	if (settings == nullptr) {
+		Fail("out of memory");
+		return;
+	}
+
+	connection = mpd_connection_new(mpd_settings_get_host(settings),
+					mpd_settings_get_port(settings), 0);
+	if (connection == nullptr) {
+		Fail("out of memory");
+		return;
+	}
+
+	if (mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS) {
+		Fail(mpd_connection_get_error_message(connection));
+		return;
+	}
+
+	if (!IsVersionSupported(mpd_connection_get_server_version(connection))) {
+		Fail("MPD version is too old (0.16.0 needed)");
+		return;
+	}
+
+	if (partition != nullptr &&
+	    (!mpd_send_command(connection, "partition", partition, nullptr) ||
+	     !mpd_response_finish(connection))) {
+		Fail(mpd_connection_get_error_message(connection));
+		return;
+	}
+
+	/* MPD older than 0.21 does not support "tagtypes clear" and
+	   sends all tags */
+	if (mpd_send_command(connection, "tagtypes", "clear", nullptr) &&
+	    mpd_response_finish(connection)) {
+		if (!SendEnableTagTypes(mpd_send_command, connection) ||
+		    !mpd_response_finish(connection)) {
+			Fail(mpd_connection_get_error_message(connection));
+			return;
+		}
+	} else if (!mpd_connection_clear_error(connection)) {
+		Fail(mpd_connection_get_error_message(connection));
+		return;
+	}
+
+	subscribed = mpd_run_subscribe(connection, "mpdscribble");
+	if (!subscribed && !mpd_connection_clear_error(connection)) {
+		Fail(mpd_connection_get_error_message(connection));
+		return;
+	}
+
+	defer_connected.Schedule();
+}
+
+void
+MpdConnector::OnDeferredConnected() noexcept
+{
+	Finish();
+}
+
+void
+MpdConnector::Finish() noexcept
+{
+	const unsigned *version = mpd_connection_get_server_version(connection);
+	const auto name = settings_name(settings);
+	if (partition != nullptr)
+		FmtInfo("connected to mpd {}.{}.{} at {}, partition {:?}",
+			version[0], version[1], version[2],
+			name, partition);
+	else
+		FmtInfo("connected to mpd {}.{}.{} at {}",
+			version[0], version[1], version[2],
+			name);
+
+	handler.OnMpdConnected(std::exchange(connection, nullptr), subscribed);
+}
+
+#else
+
+void
+MpdConnector::Start() noexcept
+{
+	assert(step == Step::CONNECT);
+	assert(!socket.IsDefined());
+
+	if (settings == nullptr) {
+		Fail("out of memory");
+		return;
+	}
+
+	timeout_timer.Schedule(std::chrono::milliseconds{mpd_settings_get_timeout_ms(settings)});
+
+	const char *host = mpd_settings_get_host(settings);
+	if (host == nullptr) {
+		Fail("no host");
+		return;
+	}
+
+	if (host[0] == '/' || host[0] == '@')
+		ConnectLocal(host);
+	else
+		Resolve(host, mpd_settings_get_port(settings));
+}
+
+void
+MpdConnector::ConnectLocal(const char *path) noexcept
+{
+	struct sockaddr_un sun{};
+	sun.sun_family = AF_UNIX;
+
+	const std::size_t length = strlen(path);
+	if (length >= sizeof(sun.sun_path)) {
+		Fail("socket path is too long");
+		return;
+	}
+
+	memcpy(sun.sun_path, path, length);
+
+	socklen_t size = sizeof(sun);
+	if (path[0] == '@') {
+		/* an abstract socket (Linux only): the name begins
+		   with a null byte and is not null-terminated */
+		sun.sun_path[0] = 0;
+		size = offsetof(struct sockaddr_un, sun_path) + length;
+	}
+
+	const int fd = StartConnect(AF_UNIX, (const struct sockaddr *)&sun,
+				    size);
+	if (fd < 0) {
+		Fail(strerror(errno));
+		return;
+	}
+
+	socket.Open(SocketDescriptor(fd));
+	socket.ScheduleWrite();
+}
+
+void
+MpdConnector::Resolve(const char *host, unsigned port) noexcept
+{
+	resolver = std::make_shared<Resolver>(host, port);
+
+	try {
+		std::thread([r = resolver](){ r->Run(); }).detach();
+	} catch (const std::system_error &e) {
+		resolver.reset();
+		Fail(e.what());
+		return;
+	}
+
+	resolver_event.Open(resolver->wake.GetSocket());
+	resolver_event.ScheduleRead();
+}
+
+void
+MpdConnector::OnResolved(unsigned) noexcept
+{
+	assert(resolver != nullptr);
+
+	resolver->wake.Read();
+	if (!resolver->done.load(std::memory_order_acquire))
+		return;
+
+	resolver_event.Cancel();
+	const auto r = std::move(resolver);
+
+	if (r->error != 0) {
+		Fail(gai_strerror(r->error));
+		return;
+	}
+
+	addresses = next_address = std::exchange(r->result, nullptr);
+	ConnectNext();
+}
+
+void
+MpdConnector::ConnectNext() noexcept
+{
+	assert(!socket.IsDefined());
+
+	int error = ENOENT;
+	while (next_address != nullptr) {
+		const auto *ai = next_address;
+		next_address = ai->ai_next;
+
+		const int fd = StartConnect(ai->ai_family, ai->ai_addr,
+					    ai->ai_addrlen);
+		if (fd >= 0) {
+			socket.Open(SocketDescriptor(fd));
+			socket.ScheduleWrite();
+			return;
+		}
+
+		error = errno;
+	}
+
+	Fail(strerror(error));
+}
+
+void
+MpdConnector::OnSocketReady(unsigned events) noexcept
+{
+	if (step == Step::CONNECT) {
+		int error = 0;
+		socklen_t size = sizeof(error);
+		if (getsockopt(socket.GetSocket().Get(), SOL_SOCKET, SO_ERROR,
+			       &error, &size) < 0)
+			error = errno;
+
+		if (error != 0) {
+			socket.Close();
+
+			if (next_address != nullptr)
+				/* try the next address of this host */
+				ConnectNext();
+			else
+				Fail(strerror(error));
+			return;
+		}
+
+		OnConnected();
+		return;
+	}
+
+	assert(async != nullptr);
+
+	if (!mpd_async_io(async, (enum mpd_async_event)ToAsyncEvents(events))) {
+		Fail(mpd_async_get_error_message(async));
+		return;
+	}
+
+	const char *line;
+	while ((line = mpd_async_recv_line(async)) != nullptr)
+		if (!OnLine(line))
+			return;
+
+	if (mpd_async_get_error(async) != MPD_ERROR_SUCCESS) {
+		Fail(mpd_async_get_error_message(async));
+		return;
+	}
+
+	socket.Schedule(FromAsyncEvents(mpd_async_events(async)));
+}
+
+void
+MpdConnector::OnConnected() noexcept
+{
+	if (addresses != nullptr) {
+		freeaddrinfo(addresses);
+		addresses = next_address = nullptr;
+	}
+
+	async = mpd_async_new(socket.GetSocket().Get());
+	if (async == nullptr) {
+		Fail("out of memory");
+		return;
+	}
+
+	step = Step::WELCOME;
+	socket.ScheduleRead();
+}
+
+bool
+MpdConnector::OnLine(const char *line) noexcept
+{
+	if (step == Step::WELCOME) {
+		unsigned version[3];
+		if (sscanf(line, "OK MPD %u.%u.%u",
+			   &version[0], &version[1], &version[2]) != 3) {
+			Fail("not an MPD server");
+			return false;
+		}
+
+		if (!IsVersionSupported(version)) {
+			Fail(fmt::format("MPD version {}.{}.{} is too old ({}.{}.{} needed)",
+					 version[0], version[1], version[2],
+					 MIN_VERSION[0], MIN_VERSION[1],
+					 MIN_VERSION[2]));
+			return false;
+		}
+
+		welcome = line;
+		return SendNext();
+	}
+
+	const bool ok = strcmp(line, "OK") == 0;
+	if (!ok && strncmp(line, "ACK ", 4) != 0) {
+		Fail(fmt::format("unexpected response from MPD: {:?}", line));
+		return false;
+	}
+
+	if (step == Step::SUBSCRIBE)
+		/* MPD may not support client-to-client messages;
+		   that is not fatal */
+		subscribed = ok;
+	else if (step == Step::TAG_TYPES_CLEAR && !ok)
+		/* MPD older than 0.21 does not support "tagtypes
+		   clear" and sends all tags; skip "tagtypes
+		   enable" */
+		step = Step::TAG_TYPES_ENABLE;
+	else if (!ok) {
+		/* "password", "partition" or "tagtypes enable" has
+		   failed */
+		Fail(line);
+		return false;
+	}
+
+	return SendNext();
+}
+
+bool
+MpdConnector::CommandSent(Step _step, bool success) noexcept
+{
+	step = _step;
+
+	if (!success) {
+		Fail(mpd_async_get_error_message(async));
+		return false;
+	}
+
+	return true;
+}
+
+bool
+MpdConnector::SendNext() noexcept
+{
+	switch (step) {
+	case Step::CONNECT:
+		break;
+
+	case Step::WELCOME:
+		if (const char *password = mpd_settings_get_password(settings);
+		    password != nullptr)
+			return CommandSent(Step::PASSWORD,
+					   mpd_async_send_command(async, "password",
+								  password, nullptr));
+
+		[[fallthrough]];
+
+	case Step::PASSWORD:
+		if (partition != nullptr)
+			return CommandSent(Step::PARTITION,
+					   mpd_async_send_command(async, "partition",
+								  partition, nullptr));
+
+		[[fallthrough]];
+
+	case Step::PARTITION:
+		return CommandSent(Step::TAG_TYPES_CLEAR,
+				   mpd_async_send_command(async, "tagtypes",
+							  "clear", nullptr));
+
+	case Step::TAG_TYPES_CLEAR:
+		return CommandSent(Step::TAG_TYPES_ENABLE,
+				   SendEnableTagTypes(mpd_async_send_command,
+						      async));
+
+	case Step::TAG_TYPES_ENABLE:
+		return CommandSent(Step::SUBSCRIBE,
+				   mpd_async_send_command(async, "subscribe",
+							  "mpdscribble", nullptr));
+
+	case Step::SUBSCRIBE:
+		Finish();
+		return false;
+	}
+
+	assert(false);
+	return false;
+}
+
+void
+MpdConnector::Finish() noexcept
+{
+	timeout_timer.Cancel();
+
+	/* the socket is now owned by the mpd_connection */
+	socket.ReleaseSocket();
+
+	struct mpd_connection *connection =
+		mpd_connection_new_async(std::exchange(async, nullptr),
+					 welcome.c_str());
+	if (connection == nullptr) {
+		Fail("out of memory");
+		return;
+	}
+
+	mpd_connection_set_timeout(connection,
+				   mpd_settings_get_timeout_ms(settings));
+
+	const unsigned *version = mpd_connection_get_server_version(connection);
+	const auto name = settings_name(settings);
+	if (partition != nullptr)
+		FmtInfo("connected to mpd {}.{}.{} at {}, partition {:?}",
+			version[0], version[1], version[2],
+			name, partition);
+	else
+		FmtInfo("connected to mpd {}.{}.{} at {}",
+			version[0], version[1], version[2],
+			name);
+
+	/* this may destroy the MpdConnector */
+	handler.OnMpdConnected(connection, subscribed);
+}
+
+#endif
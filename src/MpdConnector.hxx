@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPD_CONNECTOR_HXX
+#define MPD_CONNECTOR_HXX
+
+#include "event/CoarseTimerEvent.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/SocketEvent.hxx"
+
+#include <mpd/client.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct addrinfo;
+
+class MpdConnectorHandler {
+public:
+	/**
+	 * The connection is ready.  The handler becomes its owner,
+	 * and it may destroy the #MpdConnector.
+	 *
+	 * @param subscribed has the "mpdscribble" channel been
+	 * subscribed?
+	 */
+	virtual void OnMpdConnected(struct mpd_connection *connection,
+				    bool subscribed) noexcept = 0;
+
+	/**
+	 * Connecting has failed (the error has already been
+	 * logged).  The handler may destroy the #MpdConnector.
+	 */
+	virtual void OnMpdConnectError() noexcept = 0;
+};
+
+/**
+ * Establishes a connection to MPD without blocking the #EventLoop:
+ * the host name is resolved in a worker thread, the socket is
+ * connected in non-blocking mode, and the welcome line and the
+ * initial commands ("password", "partition", "tagtypes" and
+ * "subscribe") are
+ * exchanged with the libmpdclient async API.  Only then is the
+ * (synchronous) #mpd_connection created.
+ *
+ * On Windows, the connection is still established synchronously.
+ */
+class MpdConnector {
+	MpdConnectorHandler &handler;
+
+	/**
+	 * The host, port and password (from the configuration or the
+	 * environment).
+	 */
+	struct mpd_settings *const settings;
+
+	const char *const partition;
+
+	bool subscribed = false;
+
+	/**
+	 * Aborts if MPD does not respond in time.
+	 */
+	CoarseTimerEvent timeout_timer;
+
+	/**
+	 * Reports errors to the handler, so it is never invoked from
+	 * within Start().
+	 */
+	DeferEvent defer_error;
+
+#ifdef _WIN32
+	struct mpd_connection *connection = nullptr;
+	DeferEvent defer_connected;
+#else
+	struct Resolver;
+
+	/**
+	 * The host name lookup in progress, or nullptr.  It is shared
+	 * with the worker thread, which cannot be canceled.
+	 */
+	std::shared_ptr<Resolver> resolver;
+	SocketEvent resolver_event;
+
+	/**
+	 * The addresses of the host and the next one to try.
+	 */
+	struct addrinfo *addresses = nullptr, *next_address = nullptr;
+
+	/**
+	 * The socket being connected.  After that, it is owned by
+	 * #async.
+	 */
+	SocketEvent socket;
+
+	struct mpd_async *async = nullptr;
+
+	enum class Step {
+		CONNECT,
+		WELCOME,
+		PASSWORD,
+		PARTITION,
+		TAG_TYPES_CLEAR,
+		TAG_TYPES_ENABLE,
+		SUBSCRIBE,
+	} step = Step::CONNECT;
+
+	/**
+	 * The welcome line which is passed to
+	 * mpd_connection_new_async().
+	 */
+	std::string welcome;
+#endif
+
+public:
+	/**
+	 * @param host the host name or socket path (nullptr for the
+	 * libmpdclient default)
+	 * @param partition the MPD partition to switch to, or nullptr
+	 */
+	MpdConnector(EventLoop &event_loop, MpdConnectorHandler &_handler,
+		     const char *host, unsigned port,
+		     const char *_partition) noexcept;
+	~MpdConnector() noexcept;
+
+	MpdConnector(const MpdConnector &) = delete;
+	MpdConnector &operator=(const MpdConnector &) = delete;
+
+	/**
+	 * Start connecting.  The result is reported to the handler
+	 * later.
+	 */
+	void Start() noexcept;
+
+private:
+	/**
+	 * Log the error and report it to the handler (in the next
+	 * #EventLoop iteration).
+	 */
+	void Fail(std::string_view message) noexcept;
+
+	void Finish() noexcept;
+
+	void OnTimeout() noexcept;
+	void OnDeferredError() noexcept;
+
+#ifdef _WIN32
+	void OnDeferredConnected() noexcept;
+#else
+	void Resolve(const char *host, unsigned port) noexcept;
+	void OnResolved(unsigned events) noexcept;
+
+	/**
+	 * Connect to a local (Unix domain) socket.
+	 */
+	void ConnectLocal(const char *path) noexcept;
+
+	/**
+	 * Connect to the next address in #addresses.
+	 */
+	void ConnectNext() noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+	void OnConnected() noexcept;
+
+	/**
+	 * Handle one line received from MPD.
+	 *
+	 * @return false if the connector has finished (and may have
+	 * been destroyed)
+	 */
+	bool OnLine(const char *line) noexcept;
+
+	/**
+	 * Send the next initial command (or finish if there is none
+	 * left).
+	 *
+	 * @return false if the connector has finished
+	 */
+	bool SendNext() noexcept;
+
+	/**
+	 * A command has been passed to mpd_async_send_command().
+	 *
+	 * @param _step the step which awaits its response
+	 * @param success the return value of mpd_async_send_command()
+	 * @return false on error (the connector has finished)
+	 */
+	bool CommandSent(Step _step, bool success) noexcept;
+#endif
+};
+
+#endif
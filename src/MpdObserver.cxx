@@ -2,13 +2,17 @@
 // Copyright The Music Player Daemon Project
 
 #include "MpdObserver.hxx"
+#include "HostHealth.hxx"
 #include "Log.hxx"
 
-#include <cassert>
-#include <string>
+#ifdef HAVE_INOTIFY
+#include "SocketWatch.hxx"
+#include "lib/fmt/ExceptionFormatter.hxx"
+#endif
 
+#include <algorithm> // for std::min()
+#include <cassert>
 #include <string.h>
-#include <stdio.h>
 
 void
 MpdObserver::HandleError() noexcept
@@ -23,105 +27,117 @@ MpdObserver::HandleError() noexcept
 	socket.Abandon();
 }
 
-static std::string
-settings_name(const struct mpd_settings *settings) noexcept
+void
+MpdObserver::OnConnectTimer() noexcept
 {
-	const char *host = mpd_settings_get_host(settings);
-	if (host == nullptr)
-		host = "unknown";
-
-	if (host[0] == '/' || host[0] == '@')
-		return host;
-
-	unsigned port = mpd_settings_get_port(settings);
-	if (port == 0 || port == 6600)
-		return host;
+	assert(connection == nullptr);
+	assert(connector == nullptr);
 
-	char buffer[256];
-	snprintf(buffer, sizeof(buffer), "%s:%u", host, port);
-	return buffer;
+	MpdConnectorHandler &handler = *this;
+	connector = std::make_unique<MpdConnector>(connect_timer.GetEventLoop(),
+						   handler, host, port,
+						   partition);
+	connector->Start();
 }
 
-static std::string
-connection_settings_name(const struct mpd_connection *connection) noexcept
+void
+MpdObserver::OnMpdConnected(struct mpd_connection *c,
+			    bool _subscribed) noexcept
 {
-	const struct mpd_settings *settings =
-		mpd_connection_get_settings(connection);
-	if (settings == nullptr)
-		return "unknown";
+	connector.reset();
 
-	return settings_name(settings);
-}
+	/* this is reset as soon as MPD has answered the first
+	   query */
+	++connect_failures;
 
-bool
-MpdObserver::Connect() noexcept
-{
-	assert(connection == nullptr);
-
-	connection = mpd_connection_new(host, port, 0);
-	if (mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS) {
-		HandleError();
-		return false;
-	}
-
-	const unsigned *version = mpd_connection_get_server_version(connection);
-
-	if (mpd_connection_cmp_server_version(connection, 0, 16, 0) < 0) {
-		FmtWarning("Error: MPD version {}.{}.{} is too old ({} needed)",
-			   version[0], version[1], version[2],
-			   "0.16.0");
-		mpd_connection_free(connection);
-		connection = nullptr;
-		return false;
-	}
-
-	const auto name = connection_settings_name(connection);
-	FmtInfo("connected to mpd {}.{}.{} at {}",
-		version[0], version[1], version[2],
-		name);
+	connection = c;
+	subscribed = _subscribed;
 
 	socket.Open(SocketDescriptor(mpd_connection_get_fd(connection)));
 	socket.ScheduleRead();
 
-	subscribed = mpd_run_subscribe(connection, "mpdscribble");
-	if (!subscribed && !mpd_connection_clear_error(connection)) {
-		HandleError();
-		return false;
-	}
+	ScheduleUpdate();
+}
 
-	return true;
+void
+MpdObserver::OnMpdConnectError() noexcept
+{
+	connector.reset();
+	++connect_failures;
+	ScheduleConnect();
 }
 
+#ifdef HAVE_INOTIFY
+
 void
-MpdObserver::OnConnectTimer() noexcept
+MpdObserver::OnSocketCreated() noexcept
 {
-	if (!Connect()) {
-		ScheduleConnect();
+	if (!connect_timer.IsPending())
+		/* connected or connecting */
 		return;
-	}
 
-	ScheduleUpdate();
+	LogInfo("mpd socket has been created");
+	connect_timer.ScheduleEarlier(Event::Duration::zero());
 }
 
+#endif
+
 void
 MpdObserver::ScheduleConnect() noexcept
 {
 	assert(connection == nullptr);
 
-	LogInfo("waiting 15 seconds before reconnecting");
+	if (connect_failures == 0) {
+		/* the connection has just been lost; maybe MPD was
+		   restarted and is already back */
+		LogInfo("reconnecting");
+		connect_timer.Schedule(Event::Duration::zero());
+		return;
+	}
+
+	auto delay = MIN_RECONNECT_DELAY;
+	for (unsigned i = 1; i < connect_failures && delay < MAX_RECONNECT_DELAY; ++i)
+		delay *= 2;
+
+	delay = HostHealth::Jitter(std::min(delay, MAX_RECONNECT_DELAY));
+
+	FmtInfo("waiting {:.1f} seconds before reconnecting",
+		std::chrono::duration_cast<std::chrono::duration<double>>(delay).count());
 
-	connect_timer.Schedule(std::chrono::seconds{15});
+	connect_timer.Schedule(delay);
 }
 
 MpdObserver::MpdObserver(EventLoop &event_loop,
 			 MpdObserverListener &_listener,
-			 const char *_host, int _port) noexcept
+			 const char *_host, int _port,
+			 const char *_partition) noexcept
 	:listener(_listener),
-	 host(_host), port(_port),
+	 host(_host), port(_port), partition(_partition),
 	 connect_timer(event_loop, BIND_THIS_METHOD(OnConnectTimer)),
 	 update_timer(event_loop, BIND_THIS_METHOD(OnUpdateTimer)),
 	 socket(event_loop, BIND_THIS_METHOD(OnSocketReady))
 {
+#ifdef HAVE_INOTIFY
+	/* resolve the default host (and $MPD_HOST) the same way
+	   MpdConnector does */
+	if (struct mpd_settings *settings = mpd_settings_new(host, port, 0,
+							     nullptr, nullptr);
+	    settings != nullptr) {
+		const char *path = mpd_settings_get_host(settings);
+		if (path != nullptr && path[0] == '/') {
+			try {
+				socket_watch = std::make_unique<SocketWatch>(event_loop, path,
+									     BIND_THIS_METHOD(OnSocketCreated));
+			} catch (...) {
+				FmtWarning("Failed to watch the mpd socket: {}",
+					   std::current_exception());
+			}
+		}
+
+		mpd_settings_free(settings);
+	}
+#endif
+
 	connect_timer.Schedule(std::chrono::seconds{0});
 }
 
@@ -134,6 +150,18 @@ MpdObserver::~MpdObserver() noexcept
 		mpd_song_free(current_song);
 }
 
+/**
+ * Is this a remote stream?  Its tags may change while it is playing
+ * (e.g. the title of an internet radio station), so the song must be
+ * fetched again even if its id is the same.
+ */
+[[gnu::pure]]
+static bool
+IsRemote(const struct mpd_song *song) noexcept
+{
+	return strstr(mpd_song_get_uri(song), "://") != nullptr;
+}
+
 enum mpd_state
 MpdObserver::QueryState(struct mpd_song **song_r,
 			std::chrono::steady_clock::duration &elapsed_r) noexcept
@@ -144,10 +172,10 @@ MpdObserver::QueryState(struct mpd_song **song_r,
 
 	assert(connection != nullptr);
 
-	mpd_command_list_begin(connection, true);
-	mpd_send_status(connection);
-	mpd_send_current_song(connection);
-	mpd_command_list_end(connection);
+	if (!mpd_send_status(connection)) {
+		HandleError();
+		return MPD_STATE_UNKNOWN;
+	}
 
 	status = mpd_recv_status(connection);
 	if (!status) {
@@ -157,19 +185,28 @@ MpdObserver::QueryState(struct mpd_song **song_r,
 
 	state = mpd_status_get_state(status);
 	elapsed_r = std::chrono::milliseconds(mpd_status_get_elapsed_ms(status));
+	const int song_id = mpd_status_get_song_id(status);
 
 	mpd_status_free(status);
 
-	if (state != MPD_STATE_PLAY) {
-		if (!mpd_response_finish(connection)) {
-			HandleError();
-			return MPD_STATE_UNKNOWN;
-		}
+	if (!mpd_response_finish(connection)) {
+		HandleError();
+		return MPD_STATE_UNKNOWN;
+	}
 
+	if (state != MPD_STATE_PLAY)
 		return state;
+
+	if (current_song != nullptr && song_id >= 0 &&
+	    mpd_song_get_id(current_song) == unsigned(song_id) &&
+	    !IsRemote(current_song)) {
+		/* same song as before (e.g. after seeking): no need
+		   to fetch it again */
+		*song_r = current_song;
+		return MPD_STATE_PLAY;
 	}
 
-	if (!mpd_response_next(connection)) {
+	if (!mpd_send_current_song(connection)) {
 		HandleError();
 		return MPD_STATE_UNKNOWN;
 	}
@@ -204,6 +241,10 @@ MpdObserver::Update() noexcept
 	prev = current_song;
 	state = QueryState(&current_song, elapsed);
 
+	if (connection != nullptr)
+		/* MPD has answered: this connection works */
+		connect_failures = 0;
+
 	if (state == MPD_STATE_PAUSE) {
 		if (!was_paused)
 			listener.OnMpdPaused();
@@ -256,7 +297,7 @@ MpdObserver::Update() noexcept
 		}
 	}
 
-	if (prev != nullptr)
+	if (prev != nullptr && prev != current_song)
 		mpd_song_free(prev);
 
 	if (connection == nullptr) {
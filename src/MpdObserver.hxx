@@ -4,6 +4,8 @@
 #ifndef MPD_OBSERVER_HXX
 #define MPD_OBSERVER_HXX
 
+#include "MpdConnector.hxx"
+#include "config.h"
 #include "event/CoarseTimerEvent.hxx"
 #include "event/DeferEvent.hxx"
 #include "event/SocketEvent.hxx"
@@ -11,6 +13,11 @@
 #include <mpd/client.h>
 
 #include <chrono>
+#include <memory>
+
+#ifdef HAVE_INOTIFY
+class SocketWatch;
+#endif
 
 class MpdObserverListener {
 public:
@@ -23,12 +30,26 @@ public:
 	virtual void OnMpdResumed() noexcept = 0;
 };
 
-class MpdObserver {
+class MpdObserver final : MpdConnectorHandler {
+	/**
+	 * The reconnect delay after the first failed attempt.  It is
+	 * doubled after each further failure, up to
+	 * #MAX_RECONNECT_DELAY.
+	 */
+	static constexpr Event::Duration MIN_RECONNECT_DELAY = std::chrono::seconds{1};
+	static constexpr Event::Duration MAX_RECONNECT_DELAY = std::chrono::minutes{2};
+
 	MpdObserverListener &listener;
 
 	const char *const host;
 	const int port;
 
+	/**
+	 * The MPD partition to switch to after connecting, or
+	 * nullptr to stay in the default partition.
+	 */
+	const char *const partition;
+
 	struct mpd_connection *connection = nullptr;
 
 	bool idle_notified = false;
@@ -44,6 +65,29 @@ class MpdObserver {
 
 	bool subscribed = false;
 
+	/**
+	 * The connection being established, or nullptr.
+	 */
+	std::unique_ptr<MpdConnector> connector;
+
+	/**
+	 * The number of consecutive failed connect attempts.  A new
+	 * connection counts as a failed attempt until the first
+	 * Update() on it has succeeded, so a connection which MPD
+	 * drops right away (e.g. because "status" is not permitted)
+	 * makes the backoff grow.  After a working connection has
+	 * been lost, the first attempt is made immediately.
+	 */
+	unsigned connect_failures = 0;
+
+#ifdef HAVE_INOTIFY
+	/**
+	 * Watches MPD's local socket, to reconnect as soon as MPD
+	 * has been restarted.  nullptr if MPD is connected via TCP.
+	 */
+	std::unique_ptr<SocketWatch> socket_watch;
+#endif
+
 	CoarseTimerEvent connect_timer;
 	DeferEvent update_timer;
 	SocketEvent socket;
@@ -51,7 +95,8 @@ class MpdObserver {
 public:
 	MpdObserver(EventLoop &event_loop,
 		    MpdObserverListener &_listener,
-		    const char *_host, int _port) noexcept;
+		    const char *_host, int _port,
+		    const char *_partition=nullptr) noexcept;
 	~MpdObserver() noexcept;
 
 private:
@@ -59,10 +104,19 @@ private:
 
 	void ScheduleConnect() noexcept;
 	void OnConnectTimer() noexcept;
-	bool Connect() noexcept;
+
+#ifdef HAVE_INOTIFY
+	void OnSocketCreated() noexcept;
+#endif
 
 	void ScheduleUpdate() noexcept;
 	void OnUpdateTimer() noexcept;
+
+	/**
+	 * Query MPD's status and, if it is playing, the current song.
+	 * The song is fetched only if it differs from #current_song;
+	 * if not, #current_song itself is returned in *song_r.
+	 */
 	enum mpd_state QueryState(struct mpd_song **song_r,
 				  std::chrono::steady_clock::duration &elapsed_r) noexcept;
 	/**
@@ -75,6 +129,11 @@ private:
 	void OnSocketReady(unsigned events) noexcept;
 	void ScheduleIdle() noexcept;
 	void OnIdleResponse() noexcept;
+
+	/* virtual methods from class MpdConnectorHandler */
+	void OnMpdConnected(struct mpd_connection *c,
+			    bool _subscribed) noexcept override;
+	void OnMpdConnectError() noexcept override;
 };
 
 #endif
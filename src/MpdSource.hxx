@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPD_SOURCE_HXX
+#define MPD_SOURCE_HXX
+
+#include "time/Stopwatch.hxx"
+#include "MpdObserver.hxx"
+#include "ScrobblerRoute.hxx"
+
+#include <string>
+
+struct MpdConfig;
+
+/**
+ * Observes one MPD server (or partition) and delivers the songs it
+ * plays to its scrobblers.
+ */
+class MpdSource final : MpdObserverListener {
+	/**
+	 * Prepended to log messages; empty for the default MPD.
+	 */
+	const std::string log_prefix;
+
+	Stopwatch stopwatch;
+
+	ScrobblerRoute route;
+
+	MpdObserver observer;
+
+public:
+	/**
+	 * @param config the configuration; it must outlive this
+	 * object
+	 */
+	MpdSource(EventLoop &event_loop, const MpdConfig &config,
+		  std::vector<Scrobbler *> &&scrobblers,
+		  Event::Duration now_playing_delay) noexcept;
+
+	MpdSource(const MpdSource &) = delete;
+	MpdSource &operator=(const MpdSource &) = delete;
+
+private:
+	void OnMpdSongChanged(const struct mpd_song *song) noexcept;
+
+	/* virtual methods from MpdObserverListener */
+	void OnMpdStarted(const struct mpd_song *song) noexcept override;
+	void OnMpdPlaying(const struct mpd_song *song,
+			  std::chrono::steady_clock::duration elapsed) noexcept override;
+	void OnMpdEnded(const struct mpd_song *song,
+			bool love) noexcept override;
+	void OnMpdPaused() noexcept override;
+	void OnMpdResumed() noexcept override;
+};
+
+#endif
@@ -3,12 +3,14 @@
 
 #include "MultiScrobbler.hxx"
 #include "Scrobbler.hxx"
+#include "SharedJournal.hxx"
 #include "ScrobblerConfig.hxx"
 #include "Protocol.hxx"
-#include "Record.hxx"
+#include "lib/fmt/RuntimeError.hxx"
 #include "Log.hxx"
 
-#include <string.h>
+#include <algorithm> // for std::find_if()
+#include <map>
 
 MultiScrobbler::MultiScrobbler(const std::forward_list<ScrobblerConfig> &configs,
 			       EventLoop &event_loop,
@@ -16,8 +18,25 @@ MultiScrobbler::MultiScrobbler(const std::forward_list<ScrobblerConfig> &configs
 {
 	LogInfo("starting mpdscribble (" AS_CLIENT_ID " " AS_CLIENT_VERSION ")");
 
-	for (const auto &i : configs)
-		scrobblers.emplace_front(i, event_loop, curl_global);
+	/* scrobblers submitting to the same host share one
+	   HostHealth instance */
+	std::map<std::string_view, std::shared_ptr<HostHealth>> hosts;
+
+	for (const auto &i : configs) {
+		const auto key = HostHealth::GetKey(i.url);
+		auto &health = hosts[key];
+		if (health == nullptr)
+			health = std::make_shared<HostHealth>(key);
+
+		if (i.shared_journal && shared_journal == nullptr)
+			shared_journal = std::make_unique<SharedJournal>(event_loop, i.journal);
+
+		scrobblers.emplace_front(i, event_loop, curl_global, health,
+					 shared_journal.get());
+	}
+
+	if (shared_journal != nullptr)
+		shared_journal->FinishOpen();
 }
 
 MultiScrobbler::~MultiScrobbler() noexcept = default;
@@ -29,88 +48,29 @@ MultiScrobbler::WriteJournal() noexcept
 		i.WriteJournal();
 }
 
-void
-MultiScrobbler::NowPlaying(const char *artist, const char *track,
-			   const char *album, const char *number,
-			   const char *mbid,
-			   std::chrono::steady_clock::duration length) noexcept
-{
-	Record record;
-
-	if (artist != nullptr)
-		record.artist = artist;
-
-	if (track != nullptr)
-		record.track = track;
-
-	if (album != nullptr)
-		record.album = album;
-
-	if (number != nullptr)
-		record.number = number;
-
-	if (mbid != nullptr)
-		record.mbid = mbid;
-
-	record.length = length;
-
-	for (auto &i : scrobblers)
-		i.ScheduleNowPlaying(record);
-}
-
-void
-MultiScrobbler::SongChange(const char *file, const char *artist, const char *track,
-			   const char *album, const char *number,
-			   const char *mbid,
-			   std::chrono::steady_clock::duration length,
-			   bool love,
-			   const char *time2) noexcept
+std::vector<Scrobbler *>
+MultiScrobbler::Select(const std::forward_list<std::string> &names)
 {
-	Record record;
-
-	/* from the 1.2 protocol draft:
-
-	   You may still submit if there is no album title (variable b)
-	   You may still submit if there is no musicbrainz id available (variable m)
-
-	   everything else is mandatory.
-	 */
-	if (!(artist && strlen(artist))) {
-		FmtWarning("empty artist, not submitting; "
-			   "please check the tags on {:?}");
-		return;
-	}
+	std::vector<Scrobbler *> result;
 
-	if (!(track && strlen(track))) {
-		FmtWarning("empty title, not submitting; "
-			   "please check the tags on {:?}", file);
-		return;
+	if (names.empty()) {
+		for (auto &i : scrobblers)
+			result.push_back(&i);
+		return result;
 	}
 
-	record.artist = artist;
-	record.track = track;
-
-	if (album != nullptr)
-		record.album = album;
-
-	if (number != nullptr)
-		record.number = number;
-
-	if (mbid != nullptr)
-		record.mbid = mbid;
+	for (const auto &name : names) {
+		const auto i = std::find_if(scrobblers.begin(), scrobblers.end(),
+					    [&name](const Scrobbler &s){
+						    return s.GetName() == name;
+					    });
+		if (i == scrobblers.end())
+			throw FmtRuntimeError("No such scrobbler: {:?}", name);
 
-	record.length = length;
-	record.time = time2 ? time2 : as_timestamp();
-	record.love = love;
-	record.source = strstr(file, "://") == nullptr ? "P" : "R";
-
-	FmtInfo("{}, songchange: {} - {} ({})",
-		record.time, record.artist,
-		record.track,
-		std::chrono::duration_cast<std::chrono::seconds>(record.length).count());
+		result.push_back(&*i);
+	}
 
-	for (auto &i : scrobblers)
-		i.Push(record);
+	return result;
 }
 
 void
@@ -4,36 +4,50 @@
 #ifndef MULTI_SCROBBLER_HXX
 #define MULTI_SCROBBLER_HXX
 
-#include <chrono>
 #include <forward_list>
+#include <memory>
+#include <string>
+#include <vector>
 
 struct ScrobblerConfig;
 class CurlGlobal;
 class Scrobbler;
+class SharedJournal;
 class EventLoop;
 
+/**
+ * Owns all scrobblers.  The songs played by an MPD are delivered to
+ * them by a #ScrobblerRoute.
+ */
 class MultiScrobbler {
+	/**
+	 * The journal shared by all scrobblers which have no journal
+	 * of their own, or nullptr if none is configured.  It must
+	 * outlive #scrobblers.
+	 */
+	std::unique_ptr<SharedJournal> shared_journal;
+
 	std::forward_list<Scrobbler> scrobblers;
 
 public:
-	explicit MultiScrobbler(const std::forward_list<ScrobblerConfig> &configs,
-				EventLoop &event_loop,
-				CurlGlobal &curl_global);
+	MultiScrobbler(const std::forward_list<ScrobblerConfig> &configs,
+		       EventLoop &event_loop,
+		       CurlGlobal &curl_global);
 	~MultiScrobbler() noexcept;
 
-	void WriteJournal() noexcept;
+	MultiScrobbler(const MultiScrobbler &) = delete;
+	MultiScrobbler &operator=(const MultiScrobbler &) = delete;
 
-	void NowPlaying(const char *artist, const char *track,
-			const char *album, const char *number,
-			const char *mbid,
-			std::chrono::steady_clock::duration length) noexcept;
-
-	void SongChange(const char *file, const char *artist, const char *track,
-			const char *album, const char *number,
-			const char *mbid,
-			std::chrono::steady_clock::duration length,
-			bool love,
-			const char *time) noexcept;
+	/**
+	 * Look up scrobblers by their names.  Throws if one does not
+	 * exist.
+	 *
+	 * @param names the scrobbler names; if empty, all scrobblers
+	 * are returned
+	 */
+	std::vector<Scrobbler *> Select(const std::forward_list<std::string> &names);
+
+	void WriteJournal() noexcept;
 
 	void SubmitNow() noexcept;
 };
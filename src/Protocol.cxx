@@ -2,6 +2,14 @@
 // Copyright The Music Player Daemon Project
 
 #include "Protocol.hxx"
+#include "util/HexFormat.hxx"
+#include "util/SpanCast.hxx"
+
+#ifdef _WIN32
+#include "lib/wincrypt/MD5.hxx"
+#else
+#include "lib/gcrypt/MD5.hxx"
+#endif
 
 #include <fmt/format.h>
 
@@ -12,3 +20,14 @@ as_timestamp() noexcept
 {
 	return fmt::format("{}", time(nullptr));
 }
+
+FixedString<MD5_HEX_SIZE>
+md5_hex(std::string_view s)
+{
+#ifdef _WIN32
+	const auto binary = WinCrypt::MD5(AsBytes(s));
+#else
+	const auto binary = Gcrypt::MD5(AsBytes(s));
+#endif
+	return HexFormat(std::span{binary});
+}
@@ -5,8 +5,10 @@
 #define PROTOCOL_HXX
 
 #include "config.h"
+#include "util/FixedString.hxx"
 
 #include <string>
+#include <string_view>
 
 #define AS_CLIENT_ID "mdc"
 #define AS_CLIENT_VERSION VERSION
@@ -14,4 +16,13 @@
 std::string
 as_timestamp() noexcept;
 
+constexpr std::size_t MD5_HEX_SIZE = 32;
+
+/**
+ * Calculate the MD5 checksum of the specified string and return it
+ * in hexadecimal notation.
+ */
+FixedString<MD5_HEX_SIZE>
+md5_hex(std::string_view s);
+
 #endif
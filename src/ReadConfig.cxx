@@ -7,9 +7,12 @@
 #include "io/FileReader.hxx"
 #include "util/Compiler.h"
 #include "util/ScopeExit.hxx"
+#include "util/StringSplit.hxx"
 #include "util/StringStrip.hxx"
 #include "Config.hxx"
 #include "IniFile.hxx"
+#include "Lastfm.hxx"
+#include "ListenBrainz.hxx"
 #include "SdDaemon.hxx"
 #include "config.h"
 #include "XdgBaseDirectory.hxx"
@@ -19,7 +22,10 @@
 #include <systemd/sd-daemon.h>
 #endif
 
+#include <algorithm> // for std::none_of()
 #include <cassert>
+#include <cerrno>
+#include <limits>
 
 #include <stdlib.h>
 #include <string.h>
@@ -168,7 +174,7 @@ GetString(const IniSection &section, const std::string &key) noexcept
 	auto i = section.find(key);
 	if (i == section.end())
 		return nullptr;
-	return i->second.c_str();
+	return i->second.value.c_str();
 }
 
 static std::string
@@ -177,7 +183,50 @@ GetStdString(const IniSection &section, const std::string &key) noexcept
 	auto i = section.find(key);
 	if (i == section.end())
 		return {};
-	return i->second;
+	return i->second.value;
+}
+
+static unsigned
+GetUnsigned(const IniSection &section, const std::string &key,
+	    unsigned default_value)
+{
+	auto i = section.find(key);
+	if (i == section.end())
+		return default_value;
+
+	const char *s = i->second.value.c_str();
+
+	/* strtoul() would silently negate a value with a minus
+	   sign */
+	char *endptr;
+	errno = 0;
+	auto value = strtoul(s, &endptr, 10);
+	if (endptr == s || *endptr != 0 || *s == '-')
+		throw FmtRuntimeError("Setting {:?} on line {} is not a non-negative number: {:?}",
+				      key, i->second.line, s);
+
+	if (errno == ERANGE || value > std::numeric_limits<unsigned>::max())
+		throw FmtRuntimeError("Setting {:?} on line {} is too large: {:?}",
+				      key, i->second.line, s);
+
+	return value;
+}
+
+static bool
+GetBool(const IniSection &section, const std::string &key,
+	bool default_value)
+{
+	const char *s = GetString(section, key);
+	if (s == nullptr)
+		return default_value;
+
+	if (strcmp(s, "yes") == 0 || strcmp(s, "true") == 0)
+		return true;
+
+	if (strcmp(s, "no") == 0 || strcmp(s, "false") == 0)
+		return false;
+
+	throw FmtRuntimeError("Not a boolean: {:?}", s);
 }
 
 static bool
@@ -206,14 +255,23 @@ load_integer(const IniFile &file, const char *name, int *value_r)
 	if (section == file.end())
 		return false;
 
-	const char *s = GetString(section->second, name);
-	if (s == nullptr)
+	auto i = section->second.find(name);
+	if (i == section->second.end())
 		return false;
 
+	const char *s = i->second.value.c_str();
+
 	char *endptr;
+	errno = 0;
 	auto value = strtol(s, &endptr, 10);
 	if (endptr == s || *endptr != 0)
-		throw FmtRuntimeError("Not a number: {:?}", s);
+		throw FmtRuntimeError("Setting {:?} on line {} is not a number: {:?}",
+				      name, i->second.line, s);
+
+	if (errno == ERANGE || value < std::numeric_limits<int>::min() ||
+	    value > std::numeric_limits<int>::max())
+		throw FmtRuntimeError("Setting {:?} on line {} is out of range: {:?}",
+				      name, i->second.line, s);
 
 	*value_r = value;
 	return true;
@@ -361,6 +419,27 @@ load_ignore_list(const std::string& path, Config::IgnoreListMap& ignore_lists)
 	return &(ignore_lists[path] = std::move(ignore_list));
 }
 
+/**
+ * Returns the default URL for the given protocol, or nullptr if
+ * there is none.
+ */
+static constexpr const char *
+GetDefaultUrl(ScrobblerProtocol protocol) noexcept
+{
+	switch (protocol) {
+	case ScrobblerProtocol::AUDIOSCROBBLER:
+		break;
+
+	case ScrobblerProtocol::LASTFM:
+		return Lastfm::DEFAULT_URL;
+
+	case ScrobblerProtocol::LISTENBRAINZ:
+		return ListenBrainz::DEFAULT_URL;
+	}
+
+	return nullptr;
+}
+
 static ScrobblerConfig
 load_scrobbler_config(const Config &config,
 		      const std::string &section_name,
@@ -369,21 +448,46 @@ load_scrobbler_config(const Config &config,
 {
 	ScrobblerConfig scrobbler;
 
+	if (const char *protocol = GetString(section, "protocol")) {
+		if (strcmp(protocol, "audioscrobbler") == 0)
+			scrobbler.protocol = ScrobblerProtocol::AUDIOSCROBBLER;
+		else if (strcmp(protocol, "lastfm") == 0)
+			scrobbler.protocol = ScrobblerProtocol::LASTFM;
+		else if (strcmp(protocol, "listenbrainz") == 0)
+			scrobbler.protocol = ScrobblerProtocol::LISTENBRAINZ;
+		else
+			throw FmtRuntimeError("Unknown protocol: {:?}",
+					      protocol);
+	}
+
 	/* Use default host for mpdscribble group, for backward compatability */
 	if (section_name.empty()) {
 		scrobbler.name = "last.fm";
-		scrobbler.url = AS_HOST;
+		const char *url = GetDefaultUrl(scrobbler.protocol);
+		scrobbler.url = url != nullptr ? url : AS_HOST;
 	} else {
 		scrobbler.name = section_name;
 		scrobbler.file = GetStdString(section, "file");
 		if (scrobbler.file.empty()) {
 			scrobbler.url = GetStdString(section, "url");
+			if (scrobbler.url.empty()) {
+				if (const char *url = GetDefaultUrl(scrobbler.protocol))
+					scrobbler.url = url;
+			}
+
 			if (scrobbler.url.empty())
 				throw FmtRuntimeError("Section {:?} has neither 'file' nor 'url'", section_name);
 		}
 	}
 
-	if (scrobbler.file.empty()) {
+	if (scrobbler.file.empty() &&
+	    scrobbler.protocol == ScrobblerProtocol::LISTENBRAINZ) {
+		scrobbler.token = GetStdString(section, "token");
+		if (scrobbler.token.empty())
+			throw std::runtime_error("No 'token'");
+
+		scrobbler.max_batch = ListenBrainz::MAX_LISTENS;
+	} else if (scrobbler.file.empty()) {
 		scrobbler.username = GetStdString(section, "username");
 		if (scrobbler.username.empty())
 			throw std::runtime_error("No 'username'");
@@ -391,16 +495,72 @@ load_scrobbler_config(const Config &config,
 		scrobbler.password = GetStdString(section, "password");
 		if (scrobbler.password.empty())
 			throw std::runtime_error("No 'password'");
+
+		if (scrobbler.protocol == ScrobblerProtocol::LASTFM) {
+			scrobbler.api_key = GetStdString(section, "api_key");
+			scrobbler.api_secret = GetStdString(section, "api_secret");
+			if (scrobbler.api_key.empty() ||
+			    scrobbler.api_secret.empty())
+				throw std::runtime_error("The 'lastfm' protocol requires 'api_key' and 'api_secret'");
+
+			scrobbler.max_batch = Lastfm::MAX_SCROBBLES;
+		}
 	}
 
 	scrobbler.journal = GetStdString(section, "journal");
 	if (scrobbler.journal.empty() && section_name.empty()) {
 		/* mpdscribble <= 0.17 compatibility */
 		scrobbler.journal = GetStdString(section, "cache");
-		if (scrobbler.journal.empty())
+		if (scrobbler.journal.empty() && config.shared_journal.empty())
 			scrobbler.journal = get_default_cache_path(config);
 	}
 
+	if (scrobbler.journal.empty() && scrobbler.file.empty() &&
+	    !config.shared_journal.empty()) {
+		scrobbler.journal = config.shared_journal;
+		scrobbler.shared_journal = true;
+	}
+
+	if (const char *format = GetString(section, "journal_format")) {
+		if (strcmp(format, "text") == 0)
+			scrobbler.journal_format = JournalFormat::TEXT;
+		else if (strcmp(format, "binary") == 0)
+			scrobbler.journal_format = JournalFormat::BINARY;
+		else
+			throw FmtRuntimeError("Unknown journal format: {:?}",
+					      format);
+	}
+
+	scrobbler.journal_interval =
+		std::chrono::seconds{GetUnsigned(section, "journal_interval",
+						 config.journal_interval)};
+	scrobbler.journal_save_delay =
+		std::chrono::seconds{GetUnsigned(section, "journal_save_delay",
+						 config.journal_save_delay)};
+
+	scrobbler.quarantine = GetStdString(section, "quarantine");
+	if (scrobbler.quarantine.empty() && scrobbler.shared_journal)
+		scrobbler.quarantine = scrobbler.journal + "." +
+			scrobbler.name + ".quarantine";
+	else if (scrobbler.quarantine.empty() && !scrobbler.journal.empty())
+		scrobbler.quarantine = scrobbler.journal + ".quarantine";
+
+	scrobbler.max_batch = GetUnsigned(section, "max_batch",
+					  scrobbler.max_batch);
+	if (scrobbler.max_batch == 0)
+		throw std::runtime_error("'max_batch' must be positive");
+
+	scrobbler.adaptive_batch = GetBool(section, "adaptive_batch",
+					   scrobbler.adaptive_batch);
+
+	scrobbler.submit_window = GetUnsigned(section, "submit_window",
+					      scrobbler.submit_window);
+	if (scrobbler.submit_window == 0)
+		throw std::runtime_error("'submit_window' must be positive");
+
+	scrobbler.max_queue = GetUnsigned(section, "max_queue",
+					  scrobbler.max_queue);
+
 	std::string ignore_list = GetStdString(section, "ignore");
 	if (!ignore_list.empty()) {
 		if (auto existing_ignore_list = ignore_lists.find(ignore_list); existing_ignore_list != ignore_lists.end()) {
@@ -415,6 +575,33 @@ load_scrobbler_config(const Config &config,
 	return scrobbler;
 }
 
+static MpdConfig
+load_mpd_config(std::string_view name, const IniSection &section)
+{
+	if (name.empty())
+		throw std::runtime_error("Missing name in \"mpd:\" section");
+
+	MpdConfig mpd;
+	mpd.name = name;
+	mpd.host = GetStdString(section, "host");
+	mpd.port = GetUnsigned(section, "port", 0);
+	mpd.partition = GetStdString(section, "partition");
+
+	/* a comma-separated list of scrobbler section names */
+	const std::string value = GetStdString(section, "scrobblers");
+	std::string_view scrobblers = value;
+	auto tail = mpd.scrobblers.before_begin();
+	while (!scrobblers.empty()) {
+		const auto [item, rest] = Split(scrobblers, ',');
+		scrobblers = rest;
+
+		if (const auto i = Strip(item); !i.empty())
+			tail = mpd.scrobblers.emplace_after(tail, i);
+	}
+
+	return mpd;
+}
+
 static void
 load_config_file(Config &config, const char *path)
 {
@@ -430,9 +617,18 @@ load_config_file(Config &config, const char *path)
 			   &config.journal_interval))
 		load_unsigned(file, "cache_interval",
 			      &config.journal_interval);
+	load_unsigned(file, "journal_save_delay", &config.journal_save_delay);
+	load_string(file, "shared_journal", config.shared_journal);
+	load_unsigned(file, "now_playing_delay", &config.now_playing_delay);
 	load_integer(file, "verbose", &config.verbose);
 
 	for (const auto &section : file) {
+		if (section.first.starts_with("mpd:")) {
+			config.mpds.emplace_front(load_mpd_config(std::string_view{section.first}.substr(4),
+								  section.second));
+			continue;
+		}
+
 		if (section.first.empty() &&
 		    section.second.find("username") == section.second.end())
 			/* the default section does not contain a
@@ -465,6 +661,24 @@ file_read_config(Config &config)
 		throw FmtRuntimeError("No audioscrobbler host configured in {:?}",
 				      config.conf);
 
+	if (config.mpds.empty()) {
+		auto &mpd = config.mpds.emplace_front();
+		mpd.host = config.host;
+		mpd.port = config.port;
+	}
+
+	for (const auto &mpd : config.mpds) {
+		for (const auto &name : mpd.scrobblers) {
+			if (std::none_of(config.scrobblers.begin(),
+					 config.scrobblers.end(),
+					 [&name](const auto &i){
+						 return i.name == name;
+					 }))
+				throw FmtRuntimeError("No such scrobbler in section \"mpd:{}\": {:?}",
+						      mpd.name, name);
+		}
+	}
+
 	if (config.log.empty())
 		config.log = get_default_log_path();
 
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "Record.hxx"
+
+#include <algorithm>
+
+Record::Record(std::string_view _artist, std::string_view track,
+	       std::string_view _album, std::string_view number,
+	       std::string_view mbid,
+	       std::chrono::sys_seconds _time,
+	       std::chrono::seconds _length,
+	       bool _love, bool _radio) noexcept
+	:artist(_artist), album(_album),
+	 length(std::max<std::chrono::seconds::rep>(_length.count(), 0)),
+	 time(_time.time_since_epoch().count()),
+	 love(_love), radio(_radio)
+{
+	if (track.empty() && number.empty() && mbid.empty())
+		return;
+
+	const std::size_t size = track.size() + number.size() + mbid.size() + 3;
+	strings = std::make_unique_for_overwrite<char[]>(size);
+
+	char *p = std::copy(track.begin(), track.end(), strings.get());
+	*p++ = 0;
+
+	number_offset = p - strings.get();
+	p = std::copy(number.begin(), number.end(), p);
+	*p++ = 0;
+
+	mbid_offset = p - strings.get();
+	p = std::copy(mbid.begin(), mbid.end(), p);
+	*p = 0;
+}
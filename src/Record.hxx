@@ -4,28 +4,165 @@
 #ifndef RECORD_HXX
 #define RECORD_HXX
 
+#include "StringPool.hxx"
+
 #include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
+
+/**
+ * A song which shall be submitted to a scrobbler.
+ *
+ * This class is designed to use little memory, because large queues
+ * may contain many thousands of records: artist and album are
+ * interned in a global #PooledString pool, the other strings share
+ * one allocation, and the time stamp is stored as an integer.
+ *
+ * Instances are immutable and shared (see #RecordPtr): one record
+ * is created for each song and all scrobblers refer to it.
+ */
+class Record {
+	PooledString artist, album;
+
+	/**
+	 * The track title, the track number and the MusicBrainz id,
+	 * each one null-terminated.  This is nullptr if all of them
+	 * are empty.
+	 */
+	std::unique_ptr<char[]> strings;
+
+	/**
+	 * The offsets of the track number and the MusicBrainz id
+	 * within #strings.
+	 */
+	uint_least32_t number_offset = 0, mbid_offset = 0;
+
+	/**
+	 * The song duration in seconds.
+	 */
+	uint_least32_t length = 0;
+
+	/**
+	 * The time when the song started playing (seconds since the
+	 * epoch), or 0 if unknown.
+	 */
+	int_least64_t time = 0;
 
-struct Record {
-	std::string artist;
-	std::string track;
-	std::string album;
-	std::string number;
-	std::string mbid;
-	std::string time;
-	std::chrono::steady_clock::duration length{};
 	bool love = false;
-	const char *source = "P";
+
+	/**
+	 * Was this song played from a remote stream ("R") instead of
+	 * a local file ("P")?
+	 */
+	bool radio = false;
+
+	/**
+	 * The form-encoded submission fields of this record, built
+	 * lazily by GetFormFragment().  This is a cache which does
+	 * not affect the value, and is therefore mutable.
+	 */
+	mutable std::unique_ptr<const std::string> form_fragment;
+
+public:
+	Record() noexcept = default;
+
+	Record(std::string_view _artist, std::string_view track,
+	       std::string_view _album, std::string_view number,
+	       std::string_view mbid,
+	       std::chrono::sys_seconds _time,
+	       std::chrono::seconds _length,
+	       bool _love, bool _radio) noexcept;
+
+	Record(const Record &) = delete;
+	Record &operator=(const Record &) = delete;
+
+	std::string_view GetArtist() const noexcept {
+		return artist;
+	}
+
+	std::string_view GetTrack() const noexcept {
+		return GetString(0);
+	}
+
+	std::string_view GetAlbum() const noexcept {
+		return album;
+	}
+
+	std::string_view GetNumber() const noexcept {
+		return GetString(number_offset);
+	}
+
+	std::string_view GetMbid() const noexcept {
+		return GetString(mbid_offset);
+	}
+
+	std::chrono::sys_seconds GetTime() const noexcept {
+		return std::chrono::sys_seconds{std::chrono::seconds{time}};
+	}
+
+	/**
+	 * Returns the time as Unix time stamp, or 0 if unknown.
+	 */
+	int_least64_t GetTimestamp() const noexcept {
+		return time;
+	}
+
+	std::chrono::seconds GetLength() const noexcept {
+		return std::chrono::seconds{length};
+	}
+
+	bool IsLoved() const noexcept {
+		return love;
+	}
+
+	bool IsRadio() const noexcept {
+		return radio;
+	}
+
+	/**
+	 * Returns the "source" code of the AudioScrobbler protocol.
+	 */
+	const char *GetSource() const noexcept {
+		return radio ? "R" : "P";
+	}
+
+	/**
+	 * Returns the cached form fragment (see
+	 * FormDataBuilder::AppendFragment()).  It is built by the
+	 * given function on the first call, and then shared by all
+	 * retries and all scrobblers.
+	 */
+	template<typename F>
+	std::string_view GetFormFragment(F &&build) const {
+		if (form_fragment == nullptr)
+			form_fragment = std::make_unique<const std::string>(build(*this));
+
+		return *form_fragment;
+	}
+
+private:
+	std::string_view GetString(std::size_t offset) const noexcept {
+		if (strings == nullptr)
+			return {"", 0};
+
+		return strings.get() + offset;
+	}
 };
 
+/**
+ * A reference to a shared immutable #Record.
+ */
+using RecordPtr = std::shared_ptr<const Record>;
+
 /**
  * Does this record object have a defined and usable value?
  */
 static inline bool
 record_is_defined(const Record *record)
 {
-	return !record->artist.empty() && !record->track.empty();
+	return !record->GetArtist().empty() && !record->GetTrack().empty();
 }
 
 #endif
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef RECORD_QUEUE_HXX
+#define RECORD_QUEUE_HXX
+
+#include "Record.hxx"
+
+#include <algorithm>
+#include <deque>
+
+/**
+ * A queue of (shared) #Record objects, the oldest one first.  Unlike
+ * std::list, std::deque stores its elements in contiguous chunks,
+ * which avoids one allocation per record and makes iterating over a
+ * submission batch cache-friendly.
+ */
+using RecordQueue = std::deque<RecordPtr>;
+
+/**
+ * Remove up to the given number of records (or record offsets) from
+ * the front of the queue in one batch.
+ *
+ * @return the number of records which were actually removed
+ */
+template<typename T>
+inline std::size_t
+RemoveOldest(std::deque<T> &queue, std::size_t n) noexcept
+{
+	n = std::min(n, queue.size());
+	queue.erase(queue.begin(), std::next(queue.begin(), n));
+	return n;
+}
+
+#endif
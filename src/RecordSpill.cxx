@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "RecordSpill.hxx"
+#include "BinaryJournal.hxx"
+#include "Log.hxx"
+
+#include <cassert>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+RecordSpill::~RecordSpill() noexcept
+{
+	if (file != nullptr)
+		fclose(file);
+}
+
+bool
+RecordSpill::Open() noexcept
+{
+	if (file != nullptr)
+		return true;
+
+#ifndef _WIN32
+	if (!directory.empty()) {
+		std::string path = directory + "/mpdscribble-spill.XXXXXX";
+		const int fd = mkstemp(path.data());
+		if (fd < 0) {
+			FmtError("Failed to create {:?}: {}",
+				 path, strerror(errno));
+			return false;
+		}
+
+		/* nobody else needs to see this file */
+		unlink(path.c_str());
+
+		file = fdopen(fd, "w+b");
+		if (file == nullptr)
+			close(fd);
+	} else
+#endif
+		file = tmpfile();
+
+	if (file == nullptr) {
+		FmtError("Failed to create spill file: {}", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+bool
+RecordSpill::Push(const Record &record) noexcept
+{
+	if (!Open())
+		return false;
+
+	if (fseek(file, 0, SEEK_END) != 0)
+		return false;
+
+	binary_journal_write_record(file, record);
+	if (fflush(file) != 0) {
+		FmtError("Failed to write spill file: {}", strerror(errno));
+		return false;
+	}
+
+	++n_records;
+	return true;
+}
+
+std::size_t
+RecordSpill::Read(long &offset, RecordQueue &queue,
+		  std::size_t max) const noexcept
+{
+	assert(file != nullptr);
+
+	if (fseek(file, offset, SEEK_SET) != 0)
+		return 0;
+
+	const std::size_t n = binary_journal_read_records(file, queue, max);
+	offset = ftell(file);
+	return n;
+}
+
+std::size_t
+RecordSpill::Pop(RecordQueue &queue, std::size_t max) noexcept
+{
+	if (n_records == 0 || max == 0)
+		return 0;
+
+	std::size_t n = Read(read_offset, queue,
+			     std::min(max, n_records));
+	if (n == 0) {
+		/* the file is corrupt; there's no point in trying
+		   again */
+		FmtError("Failed to read the spill file, {} songs lost",
+			 n_records);
+		n_records = 0;
+	} else
+		n_records -= n;
+
+	if (n_records == 0)
+		/* everything has been read back: start over with an
+		   empty file */
+		Clear();
+
+	return n;
+}
+
+void
+RecordSpill::Clear() noexcept
+{
+	if (file != nullptr) {
+		fclose(file);
+		file = nullptr;
+	}
+
+	read_offset = 0;
+	n_records = 0;
+}
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef RECORD_SPILL_HXX
+#define RECORD_SPILL_HXX
+
+#include "RecordQueue.hxx"
+
+#include <cstddef>
+#include <string>
+
+#include <stdio.h>
+
+/**
+ * An on-disk overflow for a #RecordQueue: records which do not fit
+ * into the memory budget are appended to a file (in the binary
+ * journal frame format) and read back, oldest first, as the
+ * in-memory queue drains.
+ *
+ * The file is deleted right after it has been created; it only
+ * needs to live as long as the process, because the journal has a
+ * copy of all records.
+ */
+class RecordSpill {
+	/**
+	 * The file is created in this directory.  If empty, the
+	 * system's temporary directory is used.
+	 */
+	const std::string directory;
+
+	/**
+	 * The file, opened lazily by Open().
+	 */
+	FILE *file = nullptr;
+
+	/**
+	 * The file offset of the oldest record which has not been
+	 * read back yet.
+	 */
+	long read_offset = 0;
+
+	/**
+	 * The number of records in the file which have not been
+	 * read back yet.
+	 */
+	std::size_t n_records = 0;
+
+public:
+	explicit RecordSpill(std::string_view _directory) noexcept
+		:directory(_directory) {}
+
+	~RecordSpill() noexcept;
+
+	RecordSpill(const RecordSpill &) = delete;
+	RecordSpill &operator=(const RecordSpill &) = delete;
+
+	bool empty() const noexcept {
+		return n_records == 0;
+	}
+
+	std::size_t size() const noexcept {
+		return n_records;
+	}
+
+	/**
+	 * Append a record to the file.
+	 *
+	 * @return false on error (the record was not saved)
+	 */
+	bool Push(const Record &record) noexcept;
+
+	/**
+	 * Move up to the given number of (the oldest) records from
+	 * the file to the end of the queue.
+	 *
+	 * @return the number of records moved
+	 */
+	std::size_t Pop(RecordQueue &queue, std::size_t max) noexcept;
+
+	/**
+	 * Discard all records.
+	 */
+	void Clear() noexcept;
+
+	/**
+	 * Invoke the given function for each record in the file
+	 * (oldest first), without removing them.  Only a small chunk
+	 * of records is held in memory at a time.
+	 */
+	template<typename F>
+	void ForEach(F &&f) const noexcept {
+		long offset = read_offset;
+		std::size_t remaining = n_records;
+
+		while (remaining > 0) {
+			RecordQueue chunk;
+			const std::size_t n = Read(offset, chunk, 256);
+			if (n == 0)
+				break;
+
+			for (const auto &i : chunk)
+				f(*i);
+
+			remaining -= std::min(n, remaining);
+		}
+	}
+
+private:
+	bool Open() noexcept;
+
+	/**
+	 * Read up to #max records starting at the given offset, and
+	 * advance the offset.
+	 */
+	std::size_t Read(long &offset, RecordQueue &queue,
+			 std::size_t max) const noexcept;
+};
+
+#endif
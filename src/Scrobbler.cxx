@@ -5,28 +5,48 @@
 #include "Protocol.hxx"
 #include "ScrobblerConfig.hxx"
 #include "Journal.hxx"
+#include "SharedJournal.hxx"
+#include "Lastfm.hxx"
+#include "SessionFile.hxx"
+#include "ListenBrainz.hxx"
+#include "event/Loop.hxx"
 #include "lib/curl/Request.hxx"
+#include "lib/curl/HttpStatusError.hxx"
 #include "lib/fmt/ExceptionFormatter.hxx"
 #include "lib/fmt/SystemError.hxx"
 #include "Form.hxx"
 #include "Log.hxx" /* for log_date() */
-#include "util/HexFormat.hxx"
-#include "util/SpanCast.hxx"
-
-#ifdef _WIN32
-#include "lib/wincrypt/MD5.hxx"
-#else
-#include "lib/gcrypt/MD5.hxx"
-#endif
 
+#include <algorithm> // for std::min()
 #include <array>
 #include <cassert>
+#include <utility> // for std::exchange()
 
 #include <errno.h>
 #include <string.h>
 
-/* don't submit more than this amount of songs in a batch. */
-#define MAX_SUBMIT_COUNT 10
+/**
+ * The AudioScrobbler 1.2 protocol doesn't allow more than this
+ * number of songs in one submission.
+ */
+static constexpr unsigned MAX_SUBMIT_COUNT = 50;
+
+/**
+ * The initial batch size with "adaptive_batch".
+ */
+static constexpr unsigned INITIAL_ADAPTIVE_BATCH = 10;
+
+/**
+ * The maximum duration of a "now playing" request.  A notification
+ * which takes longer than this is probably stale anyway.
+ */
+static constexpr std::chrono::seconds NOW_PLAYING_TIMEOUT{10};
+
+/**
+ * A song is moved to the quarantine after the server has rejected it
+ * this many times (while accepting other songs).
+ */
+static constexpr unsigned MAX_RECORD_FAILURES = 3;
 
 namespace ResponseStrings {
 static constexpr char OK[] = "OK";
@@ -37,37 +57,164 @@ static constexpr char BADAUTH[] = "BADAUTH";
 static constexpr char BADTIME[] = "BADTIME";
 }
 
+/**
+ * Returns the directory which contains the given file, or an empty
+ * string if there is no file.
+ */
+static std::string_view
+GetParentDirectory(std::string_view path) noexcept
+{
+	if (path.empty())
+		return {};
+
+	const auto slash = path.rfind('/');
+	if (slash == path.npos)
+		return ".";
+
+	if (slash == 0)
+		return "/";
+
+	return path.substr(0, slash);
+}
+
 Scrobbler::Scrobbler(const ScrobblerConfig &_config,
 		     EventLoop &event_loop,
-		     CurlGlobal &_curl_global)
-	:config(_config), curl_global(_curl_global),
+		     CurlGlobal &_curl_global,
+		     std::shared_ptr<HostHealth> _health,
+		     SharedJournal *shared_journal)
+	:config(_config),
+	 health(_health != nullptr
+		? std::move(_health)
+		: std::make_shared<HostHealth>(HostHealth::GetKey(config.url))),
+	 curl_global(_curl_global),
 	 handshake_timer(event_loop, BIND_THIS_METHOD(OnHandshakeTimer)),
-	 submit_timer(event_loop, BIND_THIS_METHOD(OnSubmitTimer))
+	 submit_timer(event_loop, BIND_THIS_METHOD(OnSubmitTimer)),
+	 now_playing_timer(event_loop, BIND_THIS_METHOD(OnNowPlayingTimer)),
+	 journal_timer(event_loop, BIND_THIS_METHOD(OnJournalTimer)),
+	 spill(GetParentDirectory(config.journal))
 {
-	if (!config.journal.empty()) {
-		queue = journal_read(config.journal.c_str());
-
-		const unsigned queue_length = queue.size();
-		FmtInfo("loaded {} song{} from {:?}",
+	batch_size = config.adaptive_batch
+		? std::min(GetMaxBatch(), INITIAL_ADAPTIVE_BATCH)
+		: GetMaxBatch();
+
+	if (config.shared_journal) {
+		assert(shared_journal != nullptr);
+		journal = shared_journal->Open(config.name, config.ignore_list);
+	} else if (!config.journal.empty())
+		journal = std::make_unique<Journal>(event_loop,
+						    config.journal,
+						    config.journal_format);
+
+	if (journal) {
+		backlog = journal->Read();
+
+		const unsigned queue_length = backlog.size();
+		FmtInfo("[{}] loaded {} song{} from {:?}",
+			config.name,
 			queue_length, queue_length == 1 ? "" : "s",
 			config.journal);
+
+		/* decode only the head of the backlog; the rest is
+		   decoded as it gets submitted */
+		RefillQueue();
+
+		/* convert the file to the configured format before
+		   appending to it */
+		WriteJournal();
+
+		/* the shared journal has one session file per
+		   scrobbler */
+		if (config.protocol != ScrobblerProtocol::LISTENBRAINZ)
+			session_path = config.shared_journal
+				? fmt::format("{}.{}.session",
+					      config.journal, config.name)
+				: config.journal + ".session";
 	}
 
+	if (!config.quarantine.empty())
+		quarantine = std::make_unique<Journal>(event_loop,
+						       config.quarantine,
+						       JournalFormat::TEXT);
+
 	if (!config.file.empty()) {
 		file = fopen(config.file.c_str(), "a");
 		if (file == nullptr)
 			throw FmtErrno("Failed to open file {:?} of scrobbler {:?}",
 				       config.file, config.name);
-	} else
+	} else if (!LoadSession())
 		ScheduleHandshake();
+
+	health->AddListener(*this);
 }
 
 Scrobbler::~Scrobbler() noexcept
 {
+	health->RemoveListener(*this);
+
+	/* don't let the other scrobblers of this host wait for a
+	   probe which will never complete */
+	if (http_request)
+		ReleaseProbe(handshake_probe);
+	if (now_playing_channel.request)
+		ReleaseProbe(now_playing_channel.probe);
+	for (auto &batch : batches)
+		if (batch.request)
+			ReleaseProbe(batch.probe);
+
 	if (file != nullptr)
 		fclose(file);
 }
 
+bool
+Scrobbler::LoadSession() noexcept
+{
+	assert(state == State::NOTHING);
+
+	if (session_path.empty())
+		return false;
+
+	StoredSession s;
+	s.url = config.url;
+	s.username = config.username;
+	if (!session_file_load(session_path.c_str(), s))
+		return false;
+
+	FmtInfo("[{}] reusing the session from {:?}",
+		config.name, session_path);
+
+	session = std::move(s.session);
+	nowplay_url = std::move(s.nowplay_url);
+	submit_url = std::move(s.submit_url);
+	state = State::READY;
+
+	if (!queue.empty())
+		ScheduleSubmit();
+
+	return true;
+}
+
+void
+Scrobbler::SaveSession() noexcept
+{
+	if (session_path.empty())
+		return;
+
+	session_file_save(session_path.c_str(),
+			  {config.url, config.username,
+			   session, nowplay_url, submit_url});
+}
+
+void
+Scrobbler::InvalidateSession() noexcept
+{
+	session.clear();
+	nowplay_url.clear();
+	submit_url.clear();
+
+	if (!session_path.empty())
+		session_file_delete(session_path.c_str());
+}
+
 void
 Scrobbler::IncreaseInterval() noexcept
 {
@@ -84,6 +231,60 @@ Scrobbler::IncreaseInterval() noexcept
 		   std::chrono::duration_cast<std::chrono::duration<unsigned>>(interval).count());
 }
 
+unsigned
+Scrobbler::GetMaxBatch() const noexcept
+{
+	unsigned protocol_max = MAX_SUBMIT_COUNT;
+	switch (config.protocol) {
+	case ScrobblerProtocol::AUDIOSCROBBLER:
+		break;
+
+	case ScrobblerProtocol::LASTFM:
+		protocol_max = Lastfm::MAX_SCROBBLES;
+		break;
+
+	case ScrobblerProtocol::LISTENBRAINZ:
+		protocol_max = ListenBrainz::MAX_LISTENS;
+		break;
+	}
+
+	return std::min(config.max_batch, protocol_max);
+}
+
+void
+Scrobbler::GrowBatch() noexcept
+{
+	if (!config.adaptive_batch || batch_size >= GetMaxBatch())
+		return;
+
+	batch_size = std::min(batch_size * 2, GetMaxBatch());
+	FmtDebug("[{}] increasing batch size to {}", config.name, batch_size);
+}
+
+void
+Scrobbler::ShrinkBatch() noexcept
+{
+	if (!config.adaptive_batch || batch_size <= 1)
+		return;
+
+	batch_size /= 2;
+	FmtDebug("[{}] decreasing batch size to {}", config.name, batch_size);
+}
+
+void
+Scrobbler::LogDrainStatistics() noexcept
+{
+	const std::chrono::duration<double> duration =
+		std::chrono::steady_clock::now() - drain.start;
+
+	if (drain.requests > 1)
+		FmtInfo("[{}] submitted {} songs in {} requests ({:.1f} seconds)",
+			config.name, drain.songs, drain.requests,
+			duration.count());
+
+	drain = {};
+}
+
 enum class SubmitResponseType {
 	OK,
 	FAILED,
@@ -121,6 +322,123 @@ scrobbler_parse_submit_response(const char *scrobbler_name,
 	return SubmitResponseType::FAILED;
 }
 
+static SubmitResponseType
+lastfm_parse_submit_response(const char *scrobbler_name,
+			     std::string_view body) noexcept
+{
+	const auto response = Lastfm::ParseResponse(body);
+	if (response.ok) {
+		const auto ignored =
+			Lastfm::FindAttribute(body, "scrobbles", "ignored");
+		if (!ignored.empty() && ignored != "0")
+			FmtWarning("[{}] OK, but {} song(s) ignored",
+				   scrobbler_name, ignored);
+		else
+			FmtInfo("[{}] OK", scrobbler_name);
+
+		return SubmitResponseType::OK;
+	}
+
+	switch (response.error) {
+	case Lastfm::INVALID_SESSION_KEY:
+		FmtWarning("[{}] invalid session", scrobbler_name);
+		return SubmitResponseType::HANDSHAKE;
+
+	default:
+		FmtError("[{}] submission rejected: {} ({:?})",
+			 scrobbler_name, response.error, response.message);
+		return SubmitResponseType::FAILED;
+	}
+}
+
+static SubmitResponseType
+listenbrainz_parse_submit_response(const char *scrobbler_name,
+				   std::string_view body) noexcept
+{
+	if (body.find("\"ok\"") != body.npos) {
+		FmtInfo("[{}] OK", scrobbler_name);
+		return SubmitResponseType::OK;
+	}
+
+	/* ListenBrainz has no sessions: even an invalid token
+	   doesn't call for a handshake */
+	const auto message = ListenBrainz::FindErrorMessage(body);
+	if (!message.empty())
+		FmtError("[{}] submission rejected: {}",
+			 scrobbler_name, message);
+	else
+		FmtError("[{}] unknown response: {:?}",
+			 scrobbler_name, body);
+
+	return SubmitResponseType::FAILED;
+}
+
+static SubmitResponseType
+ParseSubmitResponse(const ScrobblerConfig &config,
+		    std::string_view body) noexcept
+{
+	switch (config.protocol) {
+	case ScrobblerProtocol::AUDIOSCROBBLER:
+		break;
+
+	case ScrobblerProtocol::LASTFM:
+		return lastfm_parse_submit_response(config.name.c_str(),
+						    body);
+
+	case ScrobblerProtocol::LISTENBRAINZ:
+		return listenbrainz_parse_submit_response(config.name.c_str(),
+							  body);
+	}
+
+	auto newline = body.find('\n');
+	if (newline != body.npos)
+		body = body.substr(0, newline);
+
+	return scrobbler_parse_submit_response(config.name.c_str(),
+					       body.data(), body.length());
+}
+
+/**
+ * Does the given exception indicate that the host is unreachable or
+ * overloaded (as opposed to rejecting this particular request)?
+ *
+ * @param retry_after receives the server's "Retry-After" hint
+ */
+static bool
+IsHostFailure(std::exception_ptr e, std::chrono::seconds &retry_after) noexcept
+{
+	retry_after = {};
+
+	try {
+		std::rethrow_exception(e);
+	} catch (const HttpStatusError &error) {
+		retry_after = error.GetRetryAfter();
+		return error.GetStatus() >= 500 || error.GetStatus() == 429;
+	} catch (...) {
+		/* connection failure */
+		return true;
+	}
+}
+
+/**
+ * If the given exception is a #HttpStatusError with a response body,
+ * return that body.  The Last.fm 2.0 and ListenBrainz APIs describe
+ * errors there.
+ */
+static const std::string *
+FindErrorBody(std::exception_ptr e) noexcept
+{
+	try {
+		std::rethrow_exception(e);
+	} catch (const HttpStatusError &error) {
+		if (!error.GetBody().empty())
+			return &error.GetBody();
+	} catch (...) {
+	}
+
+	return nullptr;
+}
+
 bool
 Scrobbler::ParseHandshakeResponse(const char *line) noexcept
 {
@@ -166,26 +484,15 @@ next_line(const char **input_r, const char *end)
 	return line;
 }
 
-inline void
-Scrobbler::OnHandshakeResponse(std::string body) noexcept
+bool
+Scrobbler::ParseHandshake(std::string_view body) noexcept
 {
 	const char *response = body.data();
 	const char *end = response + body.length();
-	bool ret;
-
-	assert(config.file.empty());
-	assert(state == State::HANDSHAKE);
-
-	http_request.reset();
-	state = State::NOTHING;
 
 	auto line = next_line(&response, end);
-	ret = ParseHandshakeResponse(line.c_str());
-	if (!ret) {
-		IncreaseInterval();
-		ScheduleHandshake();
-		return;
-	}
+	if (!ParseHandshakeResponse(line.c_str()))
+		return false;
 
 	session = next_line(&response, end);
 	FmtDebug("[{}] session: {:?}", config.name, session);
@@ -200,7 +507,53 @@ Scrobbler::OnHandshakeResponse(std::string body) noexcept
 		session.clear();
 		nowplay_url.clear();
 		submit_url.clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool
+Scrobbler::ParseLastfmSession(std::string_view body) noexcept
+{
+	const auto response = Lastfm::ParseResponse(body);
+	if (!response.ok) {
+		FmtError("[{}] authentication failed: {} ({:?})",
+			 config.name, response.error, response.message);
+		return false;
+	}
+
+	const auto key = Lastfm::FindElement(body, "key");
+	if (key.empty()) {
+		FmtError("[{}] no session key in response", config.name);
+		return false;
+	}
+
+	FmtInfo("[{}] authentication successful", config.name);
+
+	session = key;
+	FmtDebug("[{}] session: {:?}", config.name, session);
+
+	/* all API calls go to the same URL */
+	nowplay_url = submit_url = config.url;
+	return true;
+}
+
+inline void
+Scrobbler::OnHandshakeResponse(std::string body) noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::HANDSHAKE);
+
+	http_request.reset();
+	state = State::NOTHING;
 
+	health->OnSuccess();
+
+	const bool success = config.protocol == ScrobblerProtocol::LASTFM
+		? ParseLastfmSession(body)
+		: ParseHandshake(body);
+	if (!success) {
 		IncreaseInterval();
 		ScheduleHandshake();
 		return;
@@ -209,8 +562,13 @@ Scrobbler::OnHandshakeResponse(std::string body) noexcept
 	state = State::READY;
 	interval = std::chrono::seconds{1};
 
+	SaveSession();
+
 	/* handshake was successful: see if we have songs to submit */
 	Submit();
+
+	if (now_playing)
+		SendNowPlaying();
 }
 
 inline void
@@ -219,63 +577,55 @@ Scrobbler::OnHandshakeError(std::exception_ptr e) noexcept
 	assert(config.file.empty());
 	assert(state == State::HANDSHAKE);
 
+	std::chrono::seconds retry_after;
+	const bool host_failure = IsHostFailure(e, retry_after);
+
+	if (!host_failure &&
+	    config.protocol != ScrobblerProtocol::AUDIOSCROBBLER) {
+		if (const auto *body = FindErrorBody(e)) {
+			OnHandshakeResponse(*body);
+			return;
+		}
+	}
+
 	http_request.reset();
 	state = State::NOTHING;
 
 	FmtError("[{}] handshake error: {}", config.name, e);
 
+	if (host_failure)
+		health->OnFailure(GetNow(), retry_after);
+
 	IncreaseInterval();
 	ScheduleHandshake();
 }
 
-static void
-scrobbler_queue_remove_oldest(std::list<Record> &queue, unsigned count)
-{
-	assert(count > 0);
-
-	while (count--)
-		queue.pop_front();
-}
-
 inline void
-Scrobbler::OnSubmitResponse(std::string body) noexcept
+Scrobbler::OnNowPlayingResponse(std::string body) noexcept
 {
 	assert(config.file.empty());
-	assert(state == State::SUBMITTING);
+	assert(state == State::READY);
+	assert(now_playing);
 
-	http_request.reset();
-	state = State::READY;
+	now_playing_channel.request.reset();
 
-	auto newline = body.find('\n');
-	if (newline != body.npos)
-		body.resize(newline);
+	health->OnSuccess();
 
-	switch (scrobbler_parse_submit_response(config.name.c_str(),
-						body.data(), body.length())) {
+	switch (ParseSubmitResponse(config, body)) {
 	case SubmitResponseType::OK:
-		interval = std::chrono::seconds{1};
-
-		/* submission was accepted, so clean up the cache. */
-		if (pending > 0) {
-			scrobbler_queue_remove_oldest(queue, pending);
-			pending = 0;
-		} else {
-			assert(record_is_defined(&now_playing));
-
-			now_playing = {};
-		}
-
-
-		/* submit the next chunk (if there is some left) */
-		Submit();
+		now_playing.reset();
 		break;
 
 	case SubmitResponseType::FAILED:
 		IncreaseInterval();
-		ScheduleSubmit();
+		now_playing_timer.Schedule(GetRetryDelay());
 		break;
 
 	case SubmitResponseType::HANDSHAKE:
+		/* the notification will be sent again after the
+		   handshake */
+		CancelBatches();
+		InvalidateSession();
 		state = State::NOTHING;
 		ScheduleHandshake();
 		break;
@@ -283,236 +633,937 @@ Scrobbler::OnSubmitResponse(std::string body) noexcept
 }
 
 inline void
-Scrobbler::OnSubmitError(std::exception_ptr e) noexcept
+Scrobbler::OnNowPlayingError(std::exception_ptr e) noexcept
 {
 	assert(config.file.empty());
-	assert(state == State::SUBMITTING);
+	assert(state == State::READY);
 
-	http_request.reset();
-	state = State::READY;
+	std::chrono::seconds retry_after;
+	const bool host_failure = IsHostFailure(e, retry_after);
 
-	FmtError("[{}] submit error: {}", config.name, e);
+	if (!host_failure &&
+	    config.protocol != ScrobblerProtocol::AUDIOSCROBBLER) {
+		if (const auto *body = FindErrorBody(e)) {
+			OnNowPlayingResponse(*body);
+			return;
+		}
+	}
+
+	now_playing_channel.request.reset();
+
+	FmtError("[{}] 'now playing' error: {}", config.name, e);
+
+	if (host_failure)
+		health->OnFailure(GetNow(), retry_after);
 
 	IncreaseInterval();
-	ScheduleSubmit();
+	now_playing_timer.Schedule(GetRetryDelay());
 }
 
-static constexpr size_t MD5_SIZE = 16;
-static constexpr size_t MD5_HEX_SIZE = MD5_SIZE * 2;
-
-/**
- * Calculate the MD5 checksum of the specified string.  The return
- * value is a newly allocated string containing the hexadecimal
- * checksum.
- */
-static auto
-md5_hex(std::string_view s)
+unsigned
+Scrobbler::CountInFlight() const noexcept
 {
-#ifdef _WIN32
-	const auto binary = WinCrypt::MD5(AsBytes(s));
-#else
-	const auto binary = Gcrypt::MD5(AsBytes(s));
-#endif
-	return HexFormat(std::span{binary});
+	return std::count_if(batches.begin(), batches.end(), [](const auto &i){
+		return i.state == Batch::State::IN_FLIGHT;
+	});
 }
 
-static auto
-as_md5(const std::string &password, const std::string &timestamp)
+void
+Scrobbler::PopAckedBatches() noexcept
 {
-	std::array<char, MD5_HEX_SIZE> buffer;
+	unsigned n = 0;
+	while (!batches.empty() &&
+	       batches.front().state == Batch::State::ACKED) {
+		n += batches.front().count;
+		batches.pop_front();
+	}
 
-	auto password_md5 = std::string_view(password);
-	if (password.length() != 32) {
-		/* assume it's not hashed yet */
-		buffer = md5_hex(password);
-		password_md5 = std::string_view(buffer.data(), MD5_HEX_SIZE);
+	if (n == 0)
+		return;
+
+	/* the submission was accepted, so clean up the cache */
+	RemoveOldest(queue, n);
+	if (journal) {
+		journal->Acknowledge(n);
+		ScheduleWriteJournal();
 	}
 
-	std::string md5_with_timestamp;
-	md5_with_timestamp.reserve(password_md5.size() + timestamp.size());
-	md5_with_timestamp.append(password_md5);
-	md5_with_timestamp.append(timestamp);
-	return md5_hex(md5_with_timestamp);
+	RefillQueue();
+
+	assert(pending >= n);
+	pending -= n;
+	drain.songs += n;
 }
 
-void
-Scrobbler::Handshake() noexcept
+std::size_t
+Scrobbler::GetQueueLimit() const noexcept
 {
-	assert(config.file.empty());
+	if (config.max_queue > 0)
+		return config.max_queue;
 
-	state = State::HANDSHAKE;
+	/* no limit configured: just enough to fill the submission
+	   window */
+	return std::size_t{GetMaxBatch()} * config.submit_window;
+}
 
-	const auto timestr = as_timestamp();
-	const auto md5 = as_md5(config.password, timestr);
+void
+Scrobbler::RefillQueue() noexcept
+{
+	if (n_journal_only > 0 && queue.empty() && backlog.empty() &&
+	    spill.empty())
+		ReloadJournal();
 
-	/* construct the handshake url. */
-	FormDataBuilder url(config.url);
-	url.Append("hs", "true");
-	url.Append("p", "1.2");
-	url.Append("c", AS_CLIENT_ID);
-	url.Append("v", AS_CLIENT_VERSION);
-	url.Append("u", config.username);
-	url.Append("t", timestr);
-	url.Append("a", md5);
+	const std::size_t limit = GetQueueLimit();
 
-	//  notice ("handshake url:\n%s", url);
+	while (queue.size() < limit && !backlog.empty())
+		backlog.Pop(queue, limit - queue.size());
 
-	HttpResponseHandler &handler = *this;
-	http_request = std::make_unique<CurlRequest>(curl_global,
-						     url.c_str(), std::string(),
-						     handler);
+	if (backlog.empty() && queue.size() < limit)
+		spill.Pop(queue, limit - queue.size());
 }
 
 void
-Scrobbler::OnHandshakeTimer() noexcept
+Scrobbler::ReloadJournal() noexcept
 {
-	assert(config.file.empty());
-	assert(state == State::NOTHING);
+	assert(journal);
+	assert(n_journal_only > 0);
+	assert(queue.empty());
+	assert(backlog.empty());
+	assert(spill.empty());
+
+	/* everything else has been acknowledged, so the songs
+	   left in the journal are exactly those which were kept
+	   only there */
+	try {
+		backlog = journal->Read();
+	} catch (...) {
+		FmtError("[{}] failed to load {:?}: {}",
+			 config.name, config.journal,
+			 std::current_exception());
+	}
 
-	Handshake();
+	if (backlog.size() != n_journal_only)
+		FmtError("[{}] expected {} song{} in {:?}, found {}",
+			 config.name, n_journal_only,
+			 n_journal_only == 1 ? "" : "s",
+			 config.journal, backlog.size());
+	else
+		FmtInfo("[{}] loaded {} song{} from {:?}",
+			config.name, n_journal_only,
+			n_journal_only == 1 ? "" : "s",
+			config.journal);
+
+	n_journal_only = 0;
 }
 
 void
-Scrobbler::ScheduleHandshake() noexcept
+Scrobbler::CancelBatches() noexcept
 {
-	assert(config.file.empty());
-	assert(state == State::NOTHING);
-	assert(!handshake_timer.IsPending());
+	for (auto &batch : batches) {
+		if (batch.state == Batch::State::IN_FLIGHT) {
+			if (batch.request) {
+				batch.request.reset();
+				ReleaseProbe(batch.probe);
+			}
+
+			batch.state = Batch::State::FAILED;
+		}
+	}
 
-	handshake_timer.Schedule(interval);
+	submit_timer.Cancel();
 }
 
 void
-Scrobbler::SendNowPlaying(const char *artist,
-			  const char *track, const char *album,
-			  const char *number,
-			  const char *mbid,
-			  std::chrono::steady_clock::duration length) noexcept
+Scrobbler::SplitBatch(Batch &batch) noexcept
+{
+	assert(batch.count > 1);
+	assert(batch.state == Batch::State::FAILED);
+
+	const auto i = std::find_if(batches.begin(), batches.end(),
+				    [&batch](const auto &b){
+					    return &b == &batch;
+				    });
+	assert(i != batches.end());
+
+	FmtInfo("[{}] splitting rejected batch of {} songs",
+		config.name, batch.count);
+
+	if (unsplit_batch_size == 0)
+		unsplit_batch_size = batch_size;
+
+	const unsigned half = batch.count / 2;
+	for (unsigned count : {half, batch.count - half}) {
+		auto &b = *batches.emplace(i, *this, count);
+		b.state = Batch::State::FAILED;
+		b.split = true;
+	}
+
+	batches.erase(i);
+}
+
+void
+Scrobbler::QuarantineBatch(Batch &batch) noexcept
+{
+	assert(batch.count == 1);
+	assert(batch.state == Batch::State::FAILED);
+
+	std::size_t offset = 0;
+	for (const auto &i : batches) {
+		if (&i == &batch)
+			break;
+
+		offset += i.count;
+	}
+
+	const Record &song = *queue[offset];
+	FmtError("[{}] song rejected {} times, moving it to quarantine: {} - {}",
+		 config.name, batch.failures,
+		 song.GetArtist(), song.GetTrack());
+
+	if (quarantine)
+		quarantine->Append(song);
+
+	/* remove it from the queue as if it had been accepted; this
+	   may destroy the Batch object */
+	batch.state = Batch::State::ACKED;
+	PopAckedBatches();
+
+	if (queue.empty())
+		LogDrainStatistics();
+}
+
+void
+Scrobbler::OnBatchRejected(Batch &batch) noexcept
+{
+	assert(batch.request == nullptr);
+
+	batch.state = Batch::State::FAILED;
+	++batch.failures;
+
+	/* if the server has accepted other songs in the meantime, the
+	   problem is this batch, not the server */
+	const bool server_working =
+		n_accepted_batches != batch.accepted_mark;
+
+	/* a single rejection may be a generic server failure; only
+	   a rejected retry proves that the songs are the problem (if
+	   nothing else gets accepted, repeated rejections are the
+	   only evidence); the halves of a batch which has been
+	   proven to contain such songs are split right away */
+	const bool song_specific = batch.split
+		? server_working || batch.failures >= 2
+		: batch.failures >= 2 &&
+		(server_working || batch.failures >= MAX_RECORD_FAILURES);
+
+	if (song_specific && batch.count > 1) {
+		/* bisect the batch to find the song which is being
+		   rejected */
+		SplitBatch(batch);
+
+		if (!submit_timer.IsPending())
+			Submit();
+		return;
+	}
+
+	if (server_working && batch.failures >= MAX_RECORD_FAILURES) {
+		QuarantineBatch(batch);
+
+		if (!submit_timer.IsPending())
+			Submit();
+		return;
+	}
+
+	if (!song_specific)
+		ShrinkBatch();
+
+	if (submit_timer.IsPending())
+		return;
+
+	if (server_working)
+		/* retry this batch right away */
+		Submit();
+	else if (CountInFlight() == 0) {
+		IncreaseInterval();
+		ScheduleSubmit();
+	}
+
+	/* else: retry after the next response */
+}
+
+inline void
+Scrobbler::OnBatchResponse(Batch &batch, std::string body) noexcept
 {
 	assert(config.file.empty());
 	assert(state == State::READY);
+	assert(batch.state == Batch::State::IN_FLIGHT);
 
-	state = State::SUBMITTING;
+	batch.request.reset();
 
-	FormDataBuilder post_data;
-	post_data.Append("s", session);
-	post_data.Append("a", artist);
-	post_data.Append("t", track);
-	post_data.Append("b", album);
-	post_data.Append("l",
-			 std::chrono::duration_cast<std::chrono::seconds>(length).count());
-	post_data.Append("n", number);
-	post_data.Append("m", mbid);
+	health->OnSuccess();
 
-	FmtInfo("[{}] sending 'now playing' notification", config.name);
+	switch (ParseSubmitResponse(config, body)) {
+	case SubmitResponseType::OK:
+		interval = std::chrono::seconds{1};
+		++n_accepted_batches;
+
+		if (batch.split && unsplit_batch_size > 0) {
+			/* the rejected songs have been isolated: new
+			   batches don't need to be small */
+			batch_size = std::max(batch_size, unsplit_batch_size);
+			unsplit_batch_size = 0;
+		}
+
+		/* this may destroy the Batch object */
+		batch.state = Batch::State::ACKED;
+		PopAckedBatches();
+
+		GrowBatch();
+
+		if (queue.empty())
+			LogDrainStatistics();
+
+		/* submit the next chunk (if there is some left); if
+		   the timer is pending, a failed batch is waiting to
+		   be retried */
+		if (!submit_timer.IsPending())
+			Submit();
+		break;
+
+	case SubmitResponseType::FAILED:
+		OnBatchRejected(batch);
+		break;
+
+	case SubmitResponseType::HANDSHAKE:
+		CancelBatches();
+		CancelNowPlaying();
+		InvalidateSession();
+		state = State::NOTHING;
+		ScheduleHandshake();
+		break;
+	}
+}
+
+inline void
+Scrobbler::OnBatchError(Batch &batch, std::exception_ptr e) noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::READY);
+	assert(batch.state == Batch::State::IN_FLIGHT);
+
+	std::chrono::seconds retry_after;
+	const bool host_failure = IsHostFailure(e, retry_after);
+
+	if (!host_failure &&
+	    config.protocol != ScrobblerProtocol::AUDIOSCROBBLER) {
+		if (const auto *body = FindErrorBody(e)) {
+			OnBatchResponse(batch, *body);
+			return;
+		}
+	}
+
+	batch.request.reset();
+	batch.state = Batch::State::FAILED;
+
+	FmtError("[{}] submit error: {}", config.name, e);
+
+	if (host_failure)
+		health->OnFailure(GetNow(), retry_after);
+
+	ShrinkBatch();
+
+	if (!submit_timer.IsPending()) {
+		IncreaseInterval();
+		ScheduleSubmit();
+	}
+}
+
+Scrobbler::Batch::Batch(Scrobbler &_scrobbler, unsigned _count) noexcept
+	:scrobbler(_scrobbler), count(_count),
+	 accepted_mark(scrobbler.n_accepted_batches) {}
+
+Scrobbler::Batch::~Batch() noexcept = default;
+
+void
+Scrobbler::Batch::OnHttpResponse(std::string body) noexcept
+{
+	scrobbler.OnBatchResponse(*this, std::move(body));
+}
+
+void
+Scrobbler::Batch::OnHttpError(std::exception_ptr e) noexcept
+{
+	scrobbler.OnBatchError(*this, std::move(e));
+}
+
+static auto
+as_md5(const std::string &password, const std::string &timestamp)
+{
+	std::array<char, MD5_HEX_SIZE> buffer;
+
+	auto password_md5 = std::string_view(password);
+	if (password.length() != 32) {
+		/* assume it's not hashed yet */
+		buffer = md5_hex(password);
+		password_md5 = std::string_view(buffer.data(), MD5_HEX_SIZE);
+	}
+
+	std::string md5_with_timestamp;
+	md5_with_timestamp.reserve(password_md5.size() + timestamp.size());
+	md5_with_timestamp.append(password_md5);
+	md5_with_timestamp.append(timestamp);
+	return md5_hex(md5_with_timestamp);
+}
+
+void
+Scrobbler::Handshake() noexcept
+{
+	assert(config.file.empty());
+
+	state = State::HANDSHAKE;
+
+	switch (config.protocol) {
+	case ScrobblerProtocol::AUDIOSCROBBLER:
+		break;
+
+	case ScrobblerProtocol::LASTFM:
+		SendLastfmSessionRequest();
+		return;
+
+	case ScrobblerProtocol::LISTENBRAINZ:
+		/* there are no sessions; the token is sent with each
+		   request */
+		nowplay_url = submit_url =
+			ListenBrainz::MakeSubmitUrl(config.url);
+		state = State::READY;
+
+		if (health->IsProbing()) {
+			SendProbe();
+
+			if (now_playing && now_playing_channel.request == nullptr)
+				/* wait for the result of the probe */
+				now_playing_timer.Schedule(health->GetDelay(GetNow()));
+			return;
+		}
+
+		Submit();
+
+		if (now_playing)
+			SendNowPlaying();
+		return;
+	}
+
+	const auto timestr = as_timestamp();
+	const auto md5 = as_md5(config.password, timestr);
+
+	/* construct the handshake url. */
+	FormDataBuilder url(config.url);
+	url.Append("hs", "true");
+	url.Append("p", "1.2");
+	url.Append("c", AS_CLIENT_ID);
+	url.Append("v", AS_CLIENT_VERSION);
+	url.Append("u", config.username);
+	url.Append("t", timestr);
+	url.Append("a", md5);
+
+	//  notice ("handshake url:\n%s", url);
+
+	handshake_probe = TakeProbe();
+
+	HttpResponseHandler &handler = *this;
+	http_request = std::make_unique<CurlRequest>(curl_global,
+						     url.c_str(), std::string(),
+						     handler);
+}
+
+void
+Scrobbler::SendLastfmSessionRequest() noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::HANDSHAKE);
+
+	Lastfm::Call call("auth.getMobileSession", config.api_key);
+	call.Add("username", config.username);
+
+	if (config.password.length() == MD5_HEX_SIZE)
+		/* the password is already hashed: send an
+		   "authToken" instead */
+		call.Add("authToken",
+			 md5_hex(config.username + config.password));
+	else
+		call.Add("password", config.password);
+
+	FmtInfo("[{}] requesting session key", config.name);
+
+	handshake_probe = TakeProbe();
 
 	HttpResponseHandler &handler = *this;
 	http_request = std::make_unique<CurlRequest>(curl_global,
-						     nowplay_url.c_str(),
-						     std::move(post_data),
+						     config.url.c_str(),
+						     std::move(call).Finish(config.api_secret),
 						     handler);
 }
 
 void
-Scrobbler::ScheduleNowPlaying(const Record &song) noexcept
+Scrobbler::OnHandshakeTimer() noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::NOTHING);
+
+	if (!AcquireHost()) {
+		/* the circuit breaker is open */
+		handshake_timer.Schedule(health->GetDelay(GetNow()));
+		return;
+	}
+
+	Handshake();
+}
+
+void
+Scrobbler::ScheduleHandshake() noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::NOTHING);
+	assert(!handshake_timer.IsPending());
+
+	handshake_timer.Schedule(GetRetryDelay());
+}
+
+static std::string
+as_now_playing_body(const std::string &session, const Record &song) noexcept
+{
+	FormDataBuilder post_data;
+	post_data.Append("s", session);
+	post_data.Append("a", song.GetArtist());
+	post_data.Append("t", song.GetTrack());
+	post_data.Append("b", song.GetAlbum());
+	post_data.Append("l", song.GetLength().count());
+	post_data.Append("n", song.GetNumber());
+	post_data.Append("m", song.GetMbid());
+	return post_data;
+}
+
+static std::string
+lastfm_now_playing_body(const ScrobblerConfig &config,
+			const std::string &session,
+			const Record &song) noexcept
+{
+	Lastfm::Call call("track.updateNowPlaying", config.api_key);
+	call.Add("sk", session);
+	call.Add("artist", song.GetArtist());
+	call.Add("track", song.GetTrack());
+	call.Add("album", song.GetAlbum());
+	call.Add("trackNumber", song.GetNumber());
+	call.Add("mbid", song.GetMbid());
+	call.Add("duration", song.GetLength().count());
+	return std::move(call).Finish(config.api_secret);
+}
+
+void
+Scrobbler::SendNowPlaying() noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::READY);
+	assert(now_playing);
+
+	/* a newer song replaces the notification in flight (and
+	   takes over its probe) */
+	bool probe = TakeProbe();
+	if (now_playing_channel.request) {
+		now_playing_channel.request.reset();
+		probe |= now_playing_channel.probe;
+	}
+
+	now_playing_timer.Cancel();
+
+	const Record &song = *now_playing;
+
+	std::string post_data;
+	switch (config.protocol) {
+	case ScrobblerProtocol::AUDIOSCROBBLER:
+		post_data = as_now_playing_body(session, song);
+		break;
+
+	case ScrobblerProtocol::LASTFM:
+		post_data = lastfm_now_playing_body(config, session, song);
+		break;
+
+	case ScrobblerProtocol::LISTENBRAINZ:
+		{
+			ListenBrainz::Submission submission{"playing_now"};
+			submission.Add(song);
+			post_data = std::move(submission).Finish();
+		}
+		break;
+	}
+
+	FmtInfo("[{}] sending 'now playing' notification", config.name);
+
+	now_playing_channel.probe = probe;
+
+	HttpResponseHandler &handler = now_playing_channel;
+	now_playing_channel.request =
+		std::make_unique<CurlRequest>(curl_global,
+					      nowplay_url.c_str(),
+					      std::move(post_data),
+					      MakeRequestHeaders(),
+					      handler,
+					      NOW_PLAYING_TIMEOUT);
+}
+
+void
+Scrobbler::CancelNowPlaying() noexcept
+{
+	if (now_playing_channel.request) {
+		now_playing_channel.request.reset();
+		ReleaseProbe(now_playing_channel.probe);
+	}
+
+	now_playing_timer.Cancel();
+}
+
+void
+Scrobbler::ScheduleNowPlaying(const RecordPtr &song) noexcept
 {
 	if (file != nullptr)
 		/* there's no "now playing" support for files */
 		return;
 
-	if (config.ignore_list && config.ignore_list->matches_record(song)) {
+	if (config.ignore_list && config.ignore_list->matches_record(*song)) {
 		return;
 	}
 
 	now_playing = song;
 
-	if (state == State::READY && !submit_timer.IsPending())
-		ScheduleSubmit();
+	if (state != State::READY)
+		return;
+
+	/* send it right away; it does not wait for submissions */
+	if (AcquireHost())
+		SendNowPlaying();
+	else
+		now_playing_timer.Schedule(health->GetDelay(GetNow()));
 }
 
-void
-Scrobbler::Submit() noexcept
+bool
+Scrobbler::DiscardNowPlaying(const Record &song) noexcept
 {
-	//MAX_SUBMIT_COUNT
-	unsigned count = 0;
+	if (now_playing.get() != &song)
+		return false;
 
-	assert(config.file.empty());
-	assert(state == State::READY);
-	assert(!submit_timer.IsPending());
+	const bool canceled = now_playing_channel.request != nullptr;
 
-	if (queue.empty()) {
-		/* the submission queue is empty.  See if a "now playing" song is
-		   scheduled - these should be sent after song submissions */
-		if (record_is_defined(&now_playing))
-			SendNowPlaying(now_playing.artist.c_str(),
-				       now_playing.track.c_str(),
-				       now_playing.album.c_str(),
-				       now_playing.number.c_str(),
-				       now_playing.mbid.c_str(),
-				       now_playing.length);
+	now_playing.reset();
+	CancelNowPlaying();
+	return canceled;
+}
+
+void
+Scrobbler::OnNowPlayingTimer() noexcept
+{
+	assert(state == State::READY);
+	assert(now_playing);
 
+	if (!AcquireHost()) {
+		now_playing_timer.Schedule(health->GetDelay(GetNow()));
 		return;
 	}
 
-	state = State::SUBMITTING;
+	SendNowPlaying();
+}
+
+Scrobbler::NowPlayingChannel::NowPlayingChannel(Scrobbler &_scrobbler) noexcept
+	:scrobbler(_scrobbler) {}
 
-	/* construct the handshake url. */
+Scrobbler::NowPlayingChannel::~NowPlayingChannel() noexcept = default;
+
+void
+Scrobbler::NowPlayingChannel::OnHttpResponse(std::string body) noexcept
+{
+	scrobbler.OnNowPlayingResponse(std::move(body));
+}
+
+void
+Scrobbler::NowPlayingChannel::OnHttpError(std::exception_ptr e) noexcept
+{
+	scrobbler.OnNowPlayingError(std::move(e));
+}
+
+/**
+ * Encode the submission fields of one song with an empty index
+ * placeholder; the result is cached by Record::GetFormFragment().
+ */
+static std::string
+as_submit_fragment(const Record &song) noexcept
+{
+	FormDataBuilder fragment;
+	fragment.AppendIndexPlaceholder("a", song.GetArtist());
+	fragment.AppendIndexPlaceholder("t", song.GetTrack());
+	fragment.AppendIndexPlaceholder("l", song.GetLength().count());
+	fragment.AppendIndexPlaceholder("i", song.GetTimestamp());
+	fragment.AppendIndexPlaceholder("o", song.GetSource());
+	fragment.AppendIndexPlaceholder("r", "");
+	fragment.AppendIndexPlaceholder("b", song.GetAlbum());
+	fragment.AppendIndexPlaceholder("n", song.GetNumber());
+	fragment.AppendIndexPlaceholder("m", song.GetMbid());
+
+	if (song.IsLoved())
+		fragment.AppendIndexPlaceholder("r", "L");
+
+	return fragment;
+}
+
+static std::string
+as_submit_body(const std::string &session, const RecordQueue &queue,
+	       std::size_t offset, unsigned count) noexcept
+{
 	FormDataBuilder post_data;
 	post_data.Append("s", session);
 
-	for (const auto &i : queue) {
-		if (count >= MAX_SUBMIT_COUNT)
-			break;
+	for (unsigned i = 0; i < count; ++i) {
+		const auto &song = *queue[offset + i];
+		post_data.AppendFragment(song.GetFormFragment(as_submit_fragment),
+					 i);
+	}
+
+	return post_data;
+}
+
+static std::string
+lastfm_submit_body(const ScrobblerConfig &config, const std::string &session,
+		   const RecordQueue &queue,
+		   std::size_t offset, unsigned count) noexcept
+{
+	assert(count <= Lastfm::MAX_SCROBBLES);
+
+	Lastfm::Call call("track.scrobble", config.api_key);
+	call.Add("sk", session);
+
+	for (unsigned i = 0; i < count; ++i) {
+		const auto *song = queue[offset + i].get();
+
+		call.AddIndexed("artist", i, song->GetArtist());
+		call.AddIndexed("track", i, song->GetTrack());
+		call.AddIndexed("timestamp", i, song->GetTimestamp());
+		call.AddIndexed("album", i, song->GetAlbum());
+		call.AddIndexed("trackNumber", i, song->GetNumber());
+		call.AddIndexed("mbid", i, song->GetMbid());
+		call.AddIndexed("duration", i, song->GetLength().count());
+
+		if (song->IsRadio())
+			call.AddIndexed("chosenByUser", i, "0");
+	}
+
+	return std::move(call).Finish(config.api_secret);
+}
+
+static std::string
+listenbrainz_submit_body(const RecordQueue &queue,
+			 std::size_t offset, unsigned count) noexcept
+{
+	/* "import" is meant for submitting a backlog; a "single"
+	   submission must contain exactly one listen */
+	ListenBrainz::Submission submission{count == 1 ? "single" : "import"};
+
+	for (unsigned i = 0; i < count; ++i)
+		submission.Add(*queue[offset + i]);
+
+	return std::move(submission).Finish();
+}
+
+CurlSlist
+Scrobbler::MakeRequestHeaders() const
+{
+	CurlSlist headers;
+
+	if (config.protocol == ScrobblerProtocol::LISTENBRAINZ) {
+		headers.Append(fmt::format("Authorization: Token {}",
+					   config.token).c_str());
+		headers.Append("Content-Type: application/json");
+	}
+
+	return headers;
+}
+
+void
+Scrobbler::SendBatch(Batch &batch, std::size_t offset) noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::READY);
+	assert(batch.state != Batch::State::ACKED);
+	assert(offset + batch.count <= queue.size());
 
-		const auto *song = &i;
+	batch.state = Batch::State::IN_FLIGHT;
 
-		post_data.AppendIndexed("a", count, song->artist);
-		post_data.AppendIndexed("t", count, song->track);
-		post_data.AppendIndexed("l", count,
-					std::chrono::duration_cast<std::chrono::seconds>(song->length).count());
-		post_data.AppendIndexed("i", count, song->time);
-		post_data.AppendIndexed("o", count, song->source);
-		post_data.AppendIndexed("r", count, "");
-		post_data.AppendIndexed("b", count, song->album);
-		post_data.AppendIndexed("n", count, song->number);
-		post_data.AppendIndexed("m", count, song->mbid);
+	std::string post_data;
+	switch (config.protocol) {
+	case ScrobblerProtocol::AUDIOSCROBBLER:
+		post_data = as_submit_body(session, queue, offset, batch.count);
+		break;
 
-		if (song->love)
-			post_data.AppendIndexed("r", count, "L");
+	case ScrobblerProtocol::LASTFM:
+		post_data = lastfm_submit_body(config, session,
+					       queue, offset, batch.count);
+		break;
 
-		count++;
+	case ScrobblerProtocol::LISTENBRAINZ:
+		post_data = listenbrainz_submit_body(queue, offset,
+						     batch.count);
+		break;
 	}
 
 	FmtInfo("[{}] submitting {} song{}",
-		config.name, count, count == 1 ? "" : "s");
+		config.name, batch.count, batch.count == 1 ? "" : "s");
 	FmtDebug("[{}] post data: {:?}", config.name, post_data.c_str());
 	FmtDebug("[{}] url: {}", config.name, submit_url);
 
-	pending = count;
+	if (drain.requests++ == 0)
+		drain.start = std::chrono::steady_clock::now();
 
-	HttpResponseHandler &handler = *this;
-	http_request = std::make_unique<CurlRequest>(curl_global,
-						     submit_url.c_str(),
-						     std::move(post_data),
-						     handler);
+	batch.probe = TakeProbe();
+
+	HttpResponseHandler &handler = batch;
+	batch.request = std::make_unique<CurlRequest>(curl_global,
+						      submit_url.c_str(),
+						      std::move(post_data),
+						      MakeRequestHeaders(),
+						      handler);
+}
+
+unsigned
+Scrobbler::Submit(unsigned limit) noexcept
+{
+	assert(config.file.empty());
+	assert(state == State::READY);
+	assert(!submit_timer.IsPending());
+
+	unsigned n_in_flight = CountInFlight(), n_sent = 0;
+
+	/* retry failed batches first, keeping their position in the
+	   queue; they count against the window just like new
+	   ones */
+	std::size_t offset = 0;
+	for (auto &batch : batches) {
+		if (batch.state == Batch::State::FAILED &&
+		    n_in_flight < config.submit_window && n_sent < limit) {
+			SendBatch(batch, offset);
+			++n_in_flight;
+			++n_sent;
+		}
+
+		offset += batch.count;
+	}
+
+	assert(offset == pending);
+
+	/* fill the window with new batches */
+	while (pending < queue.size() &&
+	       n_in_flight < config.submit_window && n_sent < limit) {
+		const unsigned count =
+			std::min<std::size_t>(queue.size() - pending,
+					      batch_size);
+		auto &batch = batches.emplace_back(*this, count);
+		pending += count;
+
+		SendBatch(batch, offset);
+		++n_in_flight;
+		++n_sent;
+		offset += count;
+	}
+
+	return n_sent;
+}
+
+void
+Scrobbler::SendProbe() noexcept
+{
+	assert(state == State::READY);
+	assert(health->IsProbing());
+
+	if (Submit(1) > 0)
+		return;
+
+	if (now_playing && now_playing_channel.request == nullptr) {
+		now_playing_timer.Cancel();
+		SendNowPlaying();
+		return;
+	}
+
+	/* nothing to send: let another scrobbler send the probe */
+	probe_granted = false;
+	health->Release(GetNow());
+}
+
+bool
+Scrobbler::AcquireHost() noexcept
+{
+	if (!health->Acquire(GetNow()))
+		return false;
+
+	/* while the circuit breaker is half-open, Acquire() succeeds
+	   only for the one scrobbler which sends the probe */
+	probe_granted = health->IsProbing();
+	return true;
+}
+
+bool
+Scrobbler::TakeProbe() noexcept
+{
+	return std::exchange(probe_granted, false);
 }
 
 void
-Scrobbler::Push(const Record &song) noexcept
+Scrobbler::ReleaseProbe(bool &probe) noexcept
 {
-	if (config.ignore_list && config.ignore_list->matches_record(song)) {
+	if (std::exchange(probe, false))
+		health->Release(GetNow());
+}
+
+const std::string &
+Scrobbler::GetName() const noexcept
+{
+	return config.name;
+}
+
+void
+Scrobbler::Push(const RecordPtr &song) noexcept
+{
+	if (config.ignore_list && config.ignore_list->matches_record(*song)) {
 		return;
 	}
 
 	if (file != nullptr) {
 		fmt::print(file, "{} {} - {}\n",
 			   log_date(),
-			   song.artist, song.track);
+			   song->GetArtist(), song->GetTrack());
 		fflush(file);
 		return;
 	}
 
-	queue.emplace_back(song);
+	if (n_journal_only > 0 || !backlog.empty() || !spill.empty() ||
+	    (config.max_queue > 0 && queue.size() >= config.max_queue)) {
+		/* new songs must not overtake older ones */
+		if (n_journal_only > 0 || !spill.Push(*song)) {
+			/* don't load everything into memory, that
+			   would defeat "max_queue" */
+			if (!journal) {
+				FmtError("[{}] queue is full, dropping song {:?}",
+					 config.name, song->GetTrack());
+				return;
+			}
+
+			if (n_journal_only == 0)
+				FmtError("[{}] queue is full, keeping new songs only in {:?} until the queue has been submitted",
+					 config.name, config.journal);
+
+			++n_journal_only;
+		}
+	} else
+		queue.emplace_back(song);
+
+	if (journal) {
+		journal->Append(*song);
+		ScheduleWriteJournal();
+	}
 
 	if (state == State::READY && !submit_timer.IsPending())
 		ScheduleSubmit();
@@ -523,27 +1574,65 @@ Scrobbler::OnSubmitTimer() noexcept
 {
 	assert(state == State::READY);
 
-	Submit();
+	if (!AcquireHost()) {
+		submit_timer.Schedule(health->GetDelay(GetNow()));
+		return;
+	}
+
+	if (health->IsProbing())
+		SendProbe();
+	else
+		Submit();
 }
 
 void
 Scrobbler::ScheduleSubmit() noexcept
 {
 	assert(!submit_timer.IsPending());
-	assert(!queue.empty() || record_is_defined(&now_playing));
+	assert(!queue.empty());
+
+	submit_timer.Schedule(GetRetryDelay());
+}
+
+void
+Scrobbler::ScheduleWriteJournal() noexcept
+{
+	if (journal_timer.IsPending())
+		return;
+
+	journal_timer.Schedule(config.journal_save_delay > std::chrono::seconds{}
+			       ? config.journal_save_delay
+			       : config.journal_interval);
+}
+
+void
+Scrobbler::OnJournalTimer() noexcept
+{
+	if (journal->GetGeneration() == journal_generation)
+		/* nothing has changed since the last compaction */
+		return;
 
-	submit_timer.Schedule(interval);
+	WriteJournal();
 }
 
 void
-Scrobbler::WriteJournal() const noexcept
+Scrobbler::WriteJournal() noexcept
 {
-	if (file != nullptr || config.journal.empty())
+	if (!journal ||
+	    !journal->NeedsCompaction(config.journal_save_delay > std::chrono::seconds{}))
+		return;
+
+	if (n_journal_only > 0)
+		/* compaction would lose the songs which are only in
+		   the file */
 		return;
 
-	if (journal_write(config.journal.c_str(), queue)) {
-		unsigned queue_length = queue.size();
-		FmtInfo("[{}] saved {} song{} to {:?}",
+	if (journal->Compact(queue, &backlog, &spill)) {
+		journal_generation = journal->GetGeneration();
+
+		unsigned queue_length = queue.size() + backlog.size() +
+			spill.size();
+		FmtInfo("[{}] saving {} song{} to {:?}",
 			config.name,
 			queue_length, queue_length == 1 ? "" : "s",
 			config.journal);
@@ -564,6 +1653,55 @@ Scrobbler::SubmitNow() noexcept
 		submit_timer.Cancel();
 		ScheduleSubmit();
 	}
+
+	if (now_playing_timer.IsPending()) {
+		now_playing_timer.Cancel();
+		now_playing_timer.Schedule(GetRetryDelay());
+	}
+}
+
+Event::TimePoint
+Scrobbler::GetNow() const noexcept
+{
+	return submit_timer.GetEventLoop().SteadyNow();
+}
+
+Event::Duration
+Scrobbler::GetRetryDelay() const noexcept
+{
+	return std::max(HostHealth::Jitter(interval), health->GetDelay(GetNow()));
+}
+
+void
+Scrobbler::OnHostRecovered() noexcept
+{
+	interval = std::chrono::seconds{1};
+	ResumeSoon();
+}
+
+void
+Scrobbler::OnProbeReleased() noexcept
+{
+	/* another scrobbler had nothing to send; one of those
+	   waiting sends the probe instead */
+	ResumeSoon();
+}
+
+void
+Scrobbler::ResumeSoon() noexcept
+{
+	/* the jitter avoids sending requests for all scrobblers at
+	   the same time */
+	const auto delay = HostHealth::Jitter(std::chrono::seconds{2});
+
+	if (handshake_timer.IsPending())
+		handshake_timer.Schedule(delay);
+
+	if (submit_timer.IsPending())
+		submit_timer.Schedule(delay);
+
+	if (now_playing_timer.IsPending())
+		now_playing_timer.Schedule(delay);
 }
 
 void
@@ -578,10 +1716,6 @@ Scrobbler::OnHttpResponse(std::string body) noexcept
 	case State::HANDSHAKE:
 		OnHandshakeResponse(std::move(body));
 		break;
-
-	case State::SUBMITTING:
-		OnSubmitResponse(std::move(body));
-		break;
 	}
 }
 
@@ -597,9 +1731,5 @@ Scrobbler::OnHttpError(std::exception_ptr e) noexcept
 	case State::HANDSHAKE:
 		OnHandshakeError(std::move(e));
 		break;
-
-	case State::SUBMITTING:
-		OnSubmitError(std::move(e));
-		break;
 	}
 }
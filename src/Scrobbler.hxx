@@ -6,8 +6,12 @@
 
 #include "lib/curl/Handler.hxx"
 #include "event/CoarseTimerEvent.hxx"
-#include "Record.hxx"
+#include "HostHealth.hxx"
+#include "JournalBacklog.hxx"
+#include "RecordQueue.hxx"
+#include "RecordSpill.hxx"
 
+#include <limits>
 #include <list>
 #include <memory>
 #include <string>
@@ -15,14 +19,49 @@
 #include <stdio.h>
 
 struct ScrobblerConfig;
+class ScrobblerJournal;
+class SharedJournal;
+class Journal;
 class CurlGlobal;
 class CurlRequest;
+class CurlSlist;
 
-class Scrobbler final : HttpResponseHandler {
+class Scrobbler final : HttpResponseHandler, HostHealthListener {
 	const ScrobblerConfig &config;
 
+	/**
+	 * The health of the host, shared with other scrobblers which
+	 * submit to the same host.
+	 */
+	const std::shared_ptr<HostHealth> health;
+
+	/**
+	 * Has #health granted this scrobbler the probe request (see
+	 * AcquireHost())?  The next request which is sent carries
+	 * the probe; see TakeProbe().
+	 */
+	bool probe_granted = false;
+
 	FILE *file = nullptr;
 
+	/**
+	 * The journal which persists #queue (a private #Journal or a
+	 * cursor in a #SharedJournal), or nullptr if no journal is
+	 * configured.
+	 */
+	std::unique_ptr<ScrobblerJournal> journal;
+
+	/**
+	 * The Journal::GetGeneration() value at the last compaction.
+	 */
+	unsigned journal_generation = 0;
+
+	/**
+	 * Receives songs which the server keeps rejecting; see
+	 * ScrobblerConfig::quarantine.
+	 */
+	std::unique_ptr<Journal> quarantine;
+
 	enum class State {
 		/**
 		 * mpdscribble has started, and doesn't have a session yet.
@@ -37,14 +76,12 @@ class Scrobbler final : HttpResponseHandler {
 		HANDSHAKE,
 
 		/**
-		 * We have a session, and we're ready to submit.
+		 * We have a session, and we're ready to submit.  Song
+		 * submissions (see #batches) and a "now playing"
+		 * notification (see #now_playing_channel) may be in
+		 * progress.
 		 */
 		READY,
-
-		/**
-		 * Submission in progress, waiting for the server's response.
-		 */
-		SUBMITTING,
 	} state = State::NOTHING;
 
 	static constexpr Event::Duration MIN_INTERVAL = std::chrono::minutes{1};
@@ -58,62 +95,465 @@ class Scrobbler final : HttpResponseHandler {
 
 	CurlGlobal &curl_global;
 
+	/**
+	 * The HTTP request for the handshake.
+	 */
 	std::unique_ptr<CurlRequest> http_request;
 
+	/**
+	 * Does #http_request carry the probe request of the circuit
+	 * breaker?
+	 */
+	bool handshake_probe = false;
+
+	/**
+	 * The request slot for "now playing" notifications.  It is
+	 * independent of #batches, so a notification is neither
+	 * delayed by a long submission backlog nor does it delay
+	 * submissions.
+	 */
+	struct NowPlayingChannel final : HttpResponseHandler {
+		Scrobbler &scrobbler;
+
+		/**
+		 * The request in flight, or nullptr.  It is canceled
+		 * when a newer song needs to be announced.
+		 */
+		std::unique_ptr<CurlRequest> request;
+
+		/**
+		 * Does #request carry the probe request of the
+		 * circuit breaker?
+		 */
+		bool probe = false;
+
+		explicit NowPlayingChannel(Scrobbler &_scrobbler) noexcept;
+
+		~NowPlayingChannel() noexcept;
+
+		/* virtual methods from class HttpResponseHandler */
+		void OnHttpResponse(std::string body) noexcept override;
+		void OnHttpError(std::exception_ptr e) noexcept override;
+	} now_playing_channel{*this};
+
+	/**
+	 * One submission covering a contiguous range of #queue.
+	 */
+	struct Batch final : HttpResponseHandler {
+		Scrobbler &scrobbler;
+
+		/**
+		 * The number of songs in this batch.  The range starts
+		 * after the songs of all preceding batches in
+		 * #batches.
+		 */
+		const unsigned count;
+
+		enum class State {
+			/**
+			 * Waiting for the server's response.
+			 */
+			IN_FLIGHT,
+
+			/**
+			 * The server has accepted this batch, but
+			 * it cannot be removed from the queue until
+			 * all preceding batches have been accepted.
+			 */
+			ACKED,
+
+			/**
+			 * The submission has failed; this batch
+			 * will be submitted again.
+			 */
+			FAILED,
+		} state = State::IN_FLIGHT;
+
+		/**
+		 * The value of Scrobbler::n_accepted_batches when
+		 * this batch was created.  If it has changed since,
+		 * the server is working, and a rejection of this
+		 * batch is caused by its songs.
+		 */
+		const unsigned accepted_mark;
+
+		/**
+		 * How often has the server rejected this batch?  A
+		 * batch is split only after a retry has been rejected
+		 * as well (unless it is a half of a batch which has
+		 * already been proven to contain rejected songs); for
+		 * a batch of one song, this is the failure counter of
+		 * that song.
+		 */
+		unsigned failures = 0;
+
+		/**
+		 * Was this batch created by SplitBatch()?
+		 */
+		bool split = false;
+
+		/**
+		 * Does #request carry the probe request of the
+		 * circuit breaker?
+		 */
+		bool probe = false;
+
+		std::unique_ptr<CurlRequest> request;
+
+		Batch(Scrobbler &_scrobbler, unsigned _count) noexcept;
+
+		~Batch() noexcept;
+
+		/* virtual methods from class HttpResponseHandler */
+		void OnHttpResponse(std::string body) noexcept override;
+		void OnHttpError(std::exception_ptr e) noexcept override;
+	};
+
+	/**
+	 * The submissions which have not been removed from #queue
+	 * yet, in queue order.  At most
+	 * ScrobblerConfig::submit_window of them are in flight.
+	 */
+	std::list<Batch> batches;
+
+	/**
+	 * The number of batches accepted by the server.  See
+	 * Batch::accepted_mark.
+	 */
+	unsigned n_accepted_batches = 0;
+
 	CoarseTimerEvent handshake_timer, submit_timer;
 
+	/**
+	 * Retries a failed "now playing" notification.
+	 */
+	CoarseTimerEvent now_playing_timer;
+
+	/**
+	 * Compacts the journal after it has changed; see
+	 * ScrobblerConfig::journal_interval.  It is not scheduled
+	 * while the journal is unchanged, so an idle process does not
+	 * wake up.
+	 */
+	CoarseTimerEvent journal_timer;
+
 	std::string session;
 	std::string nowplay_url;
 	std::string submit_url;
 
-	Record now_playing;
+	/**
+	 * The file where the session is saved for reuse after a
+	 * restart, or empty if the session is not saved.
+	 */
+	std::string session_path;
+
+	/**
+	 * The song which shall be announced as "now playing", or
+	 * nullptr if there is none.  It is cleared as soon as the
+	 * server has accepted the notification.
+	 */
+	RecordPtr now_playing;
 
 	/**
 	 * A queue of #record objects.
 	 */
-	std::list<Record> queue;
+	RecordQueue queue;
+
+	/**
+	 * Songs loaded from the journal which follow #queue; they are
+	 * decoded as #queue drains.
+	 */
+	JournalBacklog backlog;
 
 	/**
-	 * How many songs are we trying to submit right now?  This
-	 * many will be shifted from #queue if the submit succeeds.
+	 * Songs which follow #backlog but exceed
+	 * ScrobblerConfig::max_queue (or which were pushed while
+	 * #backlog was not yet empty).
+	 */
+	RecordSpill spill;
+
+	/**
+	 * The number of songs which follow #spill but could not be
+	 * written to it; they exist only in the journal and will be
+	 * loaded from there by ReloadJournal() as soon as all other
+	 * songs have been submitted.  The journal must not be
+	 * compacted while there are such songs, because that writes
+	 * only the songs known to this object.
+	 */
+	std::size_t n_journal_only = 0;
+
+	/**
+	 * How many songs are covered by #batches?  They will be
+	 * shifted from #queue as soon as their batches (and all
+	 * preceding ones) have been accepted.
 	 */
 	unsigned pending = 0;
 
+	/**
+	 * The maximum number of songs in the next submission.  This
+	 * is constant unless ScrobblerConfig::adaptive_batch is
+	 * enabled.
+	 */
+	unsigned batch_size;
+
+	/**
+	 * The #batch_size before the first SplitBatch() call, or 0
+	 * if no batch has been split.  It is restored as soon as a
+	 * split batch has been accepted, i.e. the songs causing the
+	 * rejection have been isolated.
+	 */
+	unsigned unsplit_batch_size = 0;
+
+	/**
+	 * Statistics about the current attempt to drain #queue; they
+	 * are logged (and reset) as soon as the queue is empty.
+	 */
+	struct {
+		std::chrono::steady_clock::time_point start;
+		unsigned requests = 0, songs = 0;
+	} drain;
+
 public:
 	Scrobbler(const ScrobblerConfig &_config,
 		  EventLoop &event_loop,
-		  CurlGlobal &_curl_global);
+		  CurlGlobal &_curl_global,
+		  std::shared_ptr<HostHealth> _health={},
+		  SharedJournal *shared_journal=nullptr);
 	~Scrobbler() noexcept;
 
-	void Push(const Record &song) noexcept;
-	void ScheduleNowPlaying(const Record &song) noexcept;
+	[[gnu::pure]]
+	const std::string &GetName() const noexcept;
+
+	void Push(const RecordPtr &song) noexcept;
+	void ScheduleNowPlaying(const RecordPtr &song) noexcept;
+
+	/**
+	 * The song passed to ScheduleNowPlaying() is not playing
+	 * anymore: forget it and cancel its notification.  Nothing
+	 * is done if another song (e.g. from another MPD) has
+	 * replaced it meanwhile.
+	 *
+	 * @return true if a request was canceled
+	 */
+	bool DiscardNowPlaying(const Record &song) noexcept;
 	void SubmitNow() noexcept;
 
-	void WriteJournal() const noexcept;
+	/**
+	 * Compact the journal file if enough records have been
+	 * acknowledged since the last compaction (or any, if
+	 * ScrobblerConfig::journal_save_delay is set).
+	 */
+	void WriteJournal() noexcept;
 
 private:
+	/**
+	 * Load the session saved by a previous process, so no
+	 * handshake is needed.
+	 *
+	 * @return true if a session was loaded
+	 */
+	bool LoadSession() noexcept;
+
+	void SaveSession() noexcept;
+
+	/**
+	 * The server has rejected the session: forget it (also the
+	 * saved copy).
+	 */
+	void InvalidateSession() noexcept;
+
 	void ScheduleHandshake() noexcept;
 	void Handshake() noexcept;
 	bool ParseHandshakeResponse(const char *line) noexcept;
 
-	void SendNowPlaying(const char *artist,
-			    const char *track, const char *album,
-			    const char *number,
-			    const char *mbid,
-			    std::chrono::steady_clock::duration length) noexcept;
+	/**
+	 * Parse an AudioScrobbler 1.2 handshake response and store
+	 * the session.
+	 */
+	bool ParseHandshake(std::string_view body) noexcept;
+
+	/**
+	 * The Last.fm 2.0 equivalent of Handshake(): obtain a session
+	 * key with "auth.getMobileSession".
+	 */
+	void SendLastfmSessionRequest() noexcept;
+	bool ParseLastfmSession(std::string_view body) noexcept;
+
+	/**
+	 * Send #now_playing on #now_playing_channel, replacing any
+	 * notification which is still in flight.
+	 */
+	void SendNowPlaying() noexcept;
+
+	/**
+	 * Cancel the notification in flight (releasing the probe it
+	 * carries) and the retry timer.
+	 */
+	void CancelNowPlaying() noexcept;
 
 	void ScheduleSubmit() noexcept;
-	void Submit() noexcept;
+
+	/**
+	 * Retry failed batches and send new ones until
+	 * ScrobblerConfig::submit_window batches are in flight.
+	 *
+	 * @param limit the maximum number of requests to send
+	 * @return the number of requests which have been sent
+	 */
+	unsigned Submit(unsigned limit=std::numeric_limits<unsigned>::max()) noexcept;
+
+	/**
+	 * This scrobbler has been granted the probe request of the
+	 * circuit breaker: send exactly one request, or release the
+	 * probe if there is nothing to send.
+	 */
+	void SendProbe() noexcept;
+
+	/**
+	 * Wrapper for HostHealth::Acquire() which remembers whether
+	 * this scrobbler has been granted the probe request.
+	 */
+	bool AcquireHost() noexcept;
+
+	/**
+	 * Called by the methods which send a request: returns true
+	 * (once) if the request carries the probe granted by
+	 * AcquireHost().
+	 */
+	bool TakeProbe() noexcept;
+
+	/**
+	 * A request is being canceled: if it carries the probe
+	 * (according to the given flag), release it, or else all
+	 * scrobblers of this host would wait for
+	 * HostHealth::PROBE_TIMEOUT.
+	 */
+	void ReleaseProbe(bool &probe) noexcept;
+
+	/**
+	 * Returns the protocol specific headers for submission
+	 * requests.
+	 *
+	 * Throws std::bad_alloc on error.
+	 */
+	CurlSlist MakeRequestHeaders() const;
+
+	/**
+	 * Send a submission request for the given batch.
+	 *
+	 * @param offset the position of the batch's first song in
+	 * #queue
+	 */
+	void SendBatch(Batch &batch, std::size_t offset) noexcept;
+
+	[[gnu::pure]]
+	unsigned CountInFlight() const noexcept;
+
+	/**
+	 * Remove all acknowledged batches from the front of
+	 * #batches and their songs from #queue.
+	 */
+	void PopAckedBatches() noexcept;
+
+	/**
+	 * Cancel all requests of #batches; they will be submitted
+	 * again after the next handshake.
+	 */
+	void CancelBatches() noexcept;
+
+	/**
+	 * How many songs may be held in #queue while there are more
+	 * in #backlog or #spill?
+	 */
+	[[gnu::pure]]
+	std::size_t GetQueueLimit() const noexcept;
+
+	/**
+	 * Move songs from #backlog and #spill to #queue as long as
+	 * there is room.
+	 */
+	void RefillQueue() noexcept;
+
+	/**
+	 * All songs known to this object have been submitted: load
+	 * the #n_journal_only songs from the journal into #backlog.
+	 */
+	void ReloadJournal() noexcept;
+
+	/**
+	 * The server has rejected the given batch: retry it; if the
+	 * retry has been rejected as well, split it in two halves to
+	 * isolate the songs causing the rejection, or quarantine the
+	 * song if it is alone and keeps getting rejected.
+	 */
+	void OnBatchRejected(Batch &batch) noexcept;
+
+	/**
+	 * Replace the given (failed) batch with two halves which are
+	 * submitted separately.
+	 */
+	void SplitBatch(Batch &batch) noexcept;
+
+	/**
+	 * Remove the song of the given single-song batch from the
+	 * queue and append it to the quarantine file.
+	 */
+	void QuarantineBatch(Batch &batch) noexcept;
 	void IncreaseInterval() noexcept;
 
+	[[gnu::pure]]
+	unsigned GetMaxBatch() const noexcept;
+
+	/**
+	 * The last submission was accepted: increase #batch_size if
+	 * adaptive batch sizing is enabled.
+	 */
+	void GrowBatch() noexcept;
+
+	/**
+	 * The last submission has failed: decrease #batch_size if
+	 * adaptive batch sizing is enabled.
+	 */
+	void ShrinkBatch() noexcept;
+
+	void LogDrainStatistics() noexcept;
+
 	void OnHandshakeTimer() noexcept;
 	void OnSubmitTimer() noexcept;
+	void OnNowPlayingTimer() noexcept;
+
+	/**
+	 * The journal has changed: schedule #journal_timer.
+	 */
+	void ScheduleWriteJournal() noexcept;
+	void OnJournalTimer() noexcept;
+
+	/**
+	 * Returns the delay before retrying after a failure: the
+	 * jittered #interval, but no less than the circuit breaker
+	 * of the #HostHealth demands.
+	 */
+	Event::Duration GetRetryDelay() const noexcept;
+
+	[[gnu::pure]]
+	Event::TimePoint GetNow() const noexcept;
+
+	/**
+	 * Reschedule all pending timers to fire soon.
+	 */
+	void ResumeSoon() noexcept;
+
+	/* virtual methods from class HostHealthListener */
+	void OnHostRecovered() noexcept override;
+	void OnProbeReleased() noexcept override;
 
 public:
 	void OnHandshakeResponse(std::string body) noexcept;
 	void OnHandshakeError(std::exception_ptr e) noexcept;
-	void OnSubmitResponse(std::string body) noexcept;
-	void OnSubmitError(std::exception_ptr e) noexcept;
+	void OnNowPlayingResponse(std::string body) noexcept;
+	void OnNowPlayingError(std::exception_ptr e) noexcept;
+	void OnBatchResponse(Batch &batch, std::string body) noexcept;
+	void OnBatchError(Batch &batch, std::exception_ptr e) noexcept;
 
 	/* virtual methods from class HttpResponseHandler */
 	void OnHttpResponse(std::string body) noexcept override;
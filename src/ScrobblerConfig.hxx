@@ -5,7 +5,10 @@
 #define SCROBBLER_CONFIG_HXX
 
 #include "IgnoreList.hxx"
+#include "JournalFormat.hxx"
+#include "ScrobblerProtocol.hxx"
 
+#include <chrono>
 #include <string>
 
 struct ScrobblerConfig {
@@ -15,16 +18,63 @@ struct ScrobblerConfig {
 	 */
 	std::string name;
 
+	ScrobblerProtocol protocol = ScrobblerProtocol::AUDIOSCROBBLER;
+
 	std::string url;
 	std::string username;
 	std::string password;
 
+	/**
+	 * The API account used for signing Last.fm 2.0 calls (only
+	 * used with #ScrobblerProtocol::LASTFM).
+	 */
+	std::string api_key, api_secret;
+
+	/**
+	 * The user token (only used with
+	 * #ScrobblerProtocol::LISTENBRAINZ).
+	 */
+	std::string token;
+
 	/**
 	 * The path of the journal file.  It contains records which
 	 * have not been submitted yet.
 	 */
 	std::string journal;
 
+	/**
+	 * Is #journal the shared journal (see Config::shared_journal)?
+	 * Then this scrobbler only has a cursor in it.
+	 */
+	bool shared_journal = false;
+
+	/**
+	 * The format used for writing the journal file.
+	 */
+	JournalFormat journal_format = JournalFormat::TEXT;
+
+	/**
+	 * The journal is compacted this long after it has changed
+	 * (if enough songs have been submitted since the last
+	 * compaction).
+	 */
+	std::chrono::seconds journal_interval{600};
+
+	/**
+	 * If non-zero, the journal is compacted this long after it
+	 * has changed (if any song has been submitted since the last
+	 * compaction), instead of after #journal_interval.
+	 */
+	std::chrono::seconds journal_save_delay{};
+
+	/**
+	 * The path of the quarantine file.  Songs which the server
+	 * keeps rejecting are moved there (in the text journal
+	 * format), so they do not block the rest of the queue.  If
+	 * empty, they are only logged.
+	 */
+	std::string quarantine;
+
 	/**
 	 * The path of the log file.  This is set when logging to a
 	 * file is configured instead of submission to an
@@ -32,6 +82,30 @@ struct ScrobblerConfig {
 	 */
 	std::string file;
 
+	/**
+	 * The maximum number of songs submitted in one request.
+	 */
+	unsigned max_batch = 10;
+
+	/**
+	 * Adjust the batch size dynamically: grow it while the
+	 * server accepts submissions, shrink it after failures.
+	 */
+	bool adaptive_batch = false;
+
+	/**
+	 * The maximum number of submission requests which may be in
+	 * flight at the same time.
+	 */
+	unsigned submit_window = 1;
+
+	/**
+	 * The maximum number of songs kept in memory.  Further songs
+	 * are moved to a file on disk until there is room in the
+	 * in-memory queue again.  0 means no limit.
+	 */
+	unsigned max_queue = 0;
+
 	IgnoreList* ignore_list;
 };
 
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef SCROBBLER_JOURNAL_HXX
+#define SCROBBLER_JOURNAL_HXX
+
+#include "JournalBacklog.hxx"
+#include "RecordQueue.hxx"
+
+#include <string>
+
+class RecordSpill;
+
+/**
+ * The interface a #Scrobbler uses to persist its queue: either a
+ * private #Journal file or a cursor in a #SharedJournal.
+ */
+class ScrobblerJournal {
+public:
+	virtual ~ScrobblerJournal() noexcept = default;
+
+	virtual const std::string &GetPath() const noexcept = 0;
+
+	/**
+	 * Load all records which have not been acknowledged.  They
+	 * are not decoded yet; see #JournalBacklog.
+	 *
+	 * This may also be called after records have been appended
+	 * and acknowledged; the sequence of records this returns is
+	 * then the one remaining after all those operations.
+	 */
+	virtual JournalBacklog Read() = 0;
+
+	/**
+	 * Append a new record.
+	 */
+	virtual void Append(const Record &record) noexcept = 0;
+
+	/**
+	 * The given number of records (the oldest ones) have been
+	 * submitted successfully.
+	 */
+	virtual void Acknowledge(unsigned n) noexcept = 0;
+
+	/**
+	 * Returns a number which changes each time an entry is
+	 * written.  This allows callers to skip journals which have
+	 * not changed.
+	 */
+	virtual unsigned GetGeneration() const noexcept = 0;
+
+	/**
+	 * @param eager compact as soon as there is anything to drop,
+	 * instead of waiting for enough to accumulate
+	 */
+	virtual bool NeedsCompaction(bool eager) const noexcept = 0;
+
+	/**
+	 * Start rewriting the file without the acknowledged records.
+	 *
+	 * @param queue the records which have not been acknowledged
+	 * @param backlog records which follow the ones in #queue
+	 * (optional)
+	 * @param spill records which follow the ones in #backlog
+	 * (optional)
+	 * @return true if the compaction has been started
+	 */
+	virtual bool Compact(const RecordQueue &queue,
+			     const JournalBacklog *backlog,
+			     const RecordSpill *spill) noexcept = 0;
+};
+
+#endif
@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef SCROBBLER_PROTOCOL_HXX
+#define SCROBBLER_PROTOCOL_HXX
+
+#include <cstdint>
+
+enum class ScrobblerProtocol : uint_least8_t {
+	/**
+	 * The AudioScrobbler 1.2 protocol with a handshake and
+	 * session-bound submission URLs.
+	 */
+	AUDIOSCROBBLER,
+
+	/**
+	 * The Last.fm 2.0 web service API with signed
+	 * "track.scrobble" calls, see Lastfm.hxx.
+	 */
+	LASTFM,
+
+	/**
+	 * The ListenBrainz JSON API, see ListenBrainz.hxx.
+	 */
+	LISTENBRAINZ,
+};
+
+#endif
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "ScrobblerRoute.hxx"
+#include "Scrobbler.hxx"
+#include "Record.hxx"
+#include "Log.hxx"
+
+#include <cassert>
+
+#include <string.h>
+
+ScrobblerRoute::ScrobblerRoute(EventLoop &event_loop,
+			       std::vector<Scrobbler *> &&_scrobblers,
+			       Event::Duration _now_playing_delay) noexcept
+	:scrobblers(std::move(_scrobblers)),
+	 now_playing_delay(_now_playing_delay),
+	 now_playing_timer(event_loop, BIND_THIS_METHOD(OnNowPlayingTimer))
+{
+}
+
+ScrobblerRoute::~ScrobblerRoute() noexcept
+{
+	if (n_suppressed_now_playing > 0)
+		FmtInfo("suppressed {} superseded 'now playing' request{}",
+			n_suppressed_now_playing,
+			n_suppressed_now_playing == 1 ? "" : "s");
+}
+
+void
+ScrobblerRoute::NowPlaying(const char *artist, const char *track,
+			   const char *album, const char *number,
+			   const char *mbid,
+			   std::chrono::steady_clock::duration length) noexcept
+{
+	const auto record = std::make_shared<const Record>(
+		artist != nullptr ? artist : "",
+		track != nullptr ? track : "",
+		album != nullptr ? album : "",
+		number != nullptr ? number : "",
+		mbid != nullptr ? mbid : "",
+		std::chrono::sys_seconds{},
+		std::chrono::duration_cast<std::chrono::seconds>(length),
+		false, false);
+
+	if (now_playing_delay <= Event::Duration::zero()) {
+		for (auto *i : scrobblers)
+			i->ScheduleNowPlaying(record);
+		return;
+	}
+
+	/* the previous song is not playing anymore: drop its
+	   notification if it has not been sent yet, and cancel
+	   requests which are still in flight */
+	for (auto *i : scrobblers) {
+		if (now_playing != nullptr ||
+		    (announced != nullptr && i->DiscardNowPlaying(*announced)))
+			++n_suppressed_now_playing;
+	}
+
+	announced.reset();
+
+	if (now_playing != nullptr)
+		FmtDebug("'now playing' superseded: {} - {}",
+			 now_playing->GetArtist(), now_playing->GetTrack());
+
+	now_playing = record;
+	now_playing_timer.Schedule(now_playing_delay);
+}
+
+void
+ScrobblerRoute::OnNowPlayingTimer() noexcept
+{
+	assert(now_playing != nullptr);
+
+	for (auto *i : scrobblers)
+		i->ScheduleNowPlaying(now_playing);
+
+	announced = std::move(now_playing);
+}
+
+void
+ScrobblerRoute::SongChange(const char *file, const char *artist, const char *track,
+			   const char *album, const char *number,
+			   const char *mbid,
+			   std::chrono::steady_clock::duration length,
+			   bool love) noexcept
+{
+	/* from the 1.2 protocol draft:
+
+	   You may still submit if there is no album title (variable b)
+	   You may still submit if there is no musicbrainz id available (variable m)
+
+	   everything else is mandatory.
+	 */
+	if (!(artist && strlen(artist))) {
+		FmtWarning("empty artist, not submitting; "
+			   "please check the tags on {:?}", file);
+		return;
+	}
+
+	if (!(track && strlen(track))) {
+		FmtWarning("empty title, not submitting; "
+			   "please check the tags on {:?}", file);
+		return;
+	}
+
+	const auto record = std::make_shared<const Record>(
+		artist, track,
+		album != nullptr ? album : "",
+		number != nullptr ? number : "",
+		mbid != nullptr ? mbid : "",
+		std::chrono::time_point_cast<std::chrono::seconds>(std::chrono::system_clock::now()),
+		std::chrono::duration_cast<std::chrono::seconds>(length),
+		love,
+		strstr(file, "://") != nullptr);
+
+	FmtInfo("{}, songchange: {} - {} ({})",
+		record->GetTimestamp(), record->GetArtist(),
+		record->GetTrack(),
+		record->GetLength().count());
+
+	for (auto *i : scrobblers)
+		i->Push(record);
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef SCROBBLER_ROUTE_HXX
+#define SCROBBLER_ROUTE_HXX
+
+#include "Record.hxx"
+#include "event/CoarseTimerEvent.hxx"
+
+#include <chrono>
+#include <vector>
+
+class Scrobbler;
+
+/**
+ * Delivers the songs played by one MPD to a set of scrobblers (see
+ * MultiScrobbler::Select()).
+ */
+class ScrobblerRoute {
+	const std::vector<Scrobbler *> scrobblers;
+
+	/**
+	 * "Now playing" notifications are delayed by this duration,
+	 * and only the last song is sent if several songs were
+	 * started during that time (e.g. while the user skips
+	 * through a playlist).
+	 */
+	const Event::Duration now_playing_delay;
+
+	CoarseTimerEvent now_playing_timer;
+
+	/**
+	 * The song which will be announced by #now_playing_timer.
+	 */
+	RecordPtr now_playing;
+
+	/**
+	 * The song which was last passed to
+	 * Scrobbler::ScheduleNowPlaying() by #now_playing_timer.
+	 * Scrobblers may be shared with other routes, so only this
+	 * song may be discarded by this route.
+	 */
+	RecordPtr announced;
+
+	/**
+	 * The number of "now playing" requests which were not sent
+	 * or canceled because a newer song superseded them.
+	 */
+	unsigned n_suppressed_now_playing = 0;
+
+public:
+	ScrobblerRoute(EventLoop &event_loop,
+		       std::vector<Scrobbler *> &&_scrobblers,
+		       Event::Duration _now_playing_delay) noexcept;
+	~ScrobblerRoute() noexcept;
+
+	ScrobblerRoute(const ScrobblerRoute &) = delete;
+	ScrobblerRoute &operator=(const ScrobblerRoute &) = delete;
+
+	void NowPlaying(const char *artist, const char *track,
+			const char *album, const char *number,
+			const char *mbid,
+			std::chrono::steady_clock::duration length) noexcept;
+
+	void SongChange(const char *file, const char *artist, const char *track,
+			const char *album, const char *number,
+			const char *mbid,
+			std::chrono::steady_clock::duration length,
+			bool love) noexcept;
+
+	unsigned GetSuppressedNowPlaying() const noexcept {
+		return n_suppressed_now_playing;
+	}
+
+private:
+	void OnNowPlayingTimer() noexcept;
+};
+
+#endif
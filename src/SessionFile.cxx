@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "SessionFile.hxx"
+#include "lib/fmt/ExceptionFormatter.hxx"
+#include "io/BufferedReader.hxx"
+#include "io/FileReader.hxx"
+#include "system/Error.hxx"
+#include "util/StringStrip.hxx"
+#include "Log.hxx"
+
+#include <fmt/core.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool
+session_file_load(const char *path, StoredSession &s) noexcept
+try {
+	FileReader file{path};
+	BufferedReader reader{file};
+
+	std::string url, username;
+	s.session.clear();
+	s.nowplay_url.clear();
+	s.submit_url.clear();
+
+	while (char *line = reader.ReadLine()) {
+		char *key = StripLeft(line);
+		if (*key == 0 || *key == '#')
+			continue;
+
+		char *value = strchr(key, '=');
+		if (value == nullptr || value == key)
+			continue;
+
+		*value++ = 0;
+
+		StripRight(key);
+		value = Strip(value);
+
+		if (strcmp(key, "url") == 0)
+			url = value;
+		else if (strcmp(key, "username") == 0)
+			username = value;
+		else if (strcmp(key, "session") == 0)
+			s.session = value;
+		else if (strcmp(key, "nowplay_url") == 0)
+			s.nowplay_url = value;
+		else if (strcmp(key, "submit_url") == 0)
+			s.submit_url = value;
+	}
+
+	/* discard sessions which were obtained for a different
+	   account */
+	return url == s.url && username == s.username &&
+		!s.session.empty() &&
+		!s.nowplay_url.empty() && !s.submit_url.empty();
+} catch (const std::system_error &e) {
+	if (!IsFileNotFound(e))
+		/* ENOENT is ignored silently: there is no session
+		   yet */
+		FmtWarning("Failed to load {:?}: {}",
+			   path, std::current_exception());
+
+	return false;
+} catch (...) {
+	FmtWarning("Failed to load {:?}: {}",
+		   path, std::current_exception());
+	return false;
+}
+
+/**
+ * Open the file for writing, creating it with permissions which
+ * allow only the owner to read it.
+ */
+static FILE *
+OpenPrivate(const char *path) noexcept
+{
+#ifdef _WIN32
+	return fopen(path, "w");
+#else
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (fd < 0)
+		return nullptr;
+
+	/* fix the permissions of an existing file */
+	fchmod(fd, 0600);
+
+	FILE *file = fdopen(fd, "w");
+	if (file == nullptr)
+		close(fd);
+	return file;
+#endif
+}
+
+bool
+session_file_save(const char *path, const StoredSession &s) noexcept
+{
+	FILE *file = OpenPrivate(path);
+	if (file == nullptr) {
+		FmtError("Failed to save {:?}: {}", path, strerror(errno));
+		return false;
+	}
+
+	fmt::print(file,
+		   "# the session of a scrobbler; this file is managed by mpdscribble\n"
+		   "url = {}\n"
+		   "username = {}\n"
+		   "session = {}\n"
+		   "nowplay_url = {}\n"
+		   "submit_url = {}\n",
+		   s.url, s.username, s.session, s.nowplay_url, s.submit_url);
+
+	if (fclose(file) != 0) {
+		FmtError("Failed to save {:?}: {}", path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+void
+session_file_delete(const char *path) noexcept
+{
+	if (unlink(path) < 0 && errno != ENOENT)
+		FmtWarning("Failed to delete {:?}: {}", path, strerror(errno));
+}
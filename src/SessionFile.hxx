@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef SESSION_FILE_HXX
+#define SESSION_FILE_HXX
+
+#include <string>
+
+/**
+ * A session obtained by a handshake.  It is saved to a file (next to
+ * the journal) so it can be reused after a restart.
+ */
+struct StoredSession {
+	/**
+	 * The account this session belongs to.  A session file
+	 * saved for a different account is ignored.
+	 */
+	std::string url, username;
+
+	std::string session, nowplay_url, submit_url;
+};
+
+/**
+ * Load a session file written by session_file_save().  Errors are
+ * logged.
+ *
+ * @param s the caller sets StoredSession::url and
+ * StoredSession::username; the other attributes are loaded from the
+ * file
+ * @return true if a session for the given account was found
+ */
+bool
+session_file_load(const char *path, StoredSession &s) noexcept;
+
+/**
+ * Save the session to a file which is only readable by the owner.
+ *
+ * @return true on success
+ */
+bool
+session_file_save(const char *path, const StoredSession &s) noexcept;
+
+/**
+ * Delete the session file because the server has invalidated the
+ * session.
+ */
+void
+session_file_delete(const char *path) noexcept;
+
+#endif
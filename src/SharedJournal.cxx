@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "SharedJournal.hxx"
+#include "IgnoreList.hxx"
+#include "Record.hxx"
+#include "lib/fmt/ExceptionFormatter.hxx"
+#include "lib/fmt/RuntimeError.hxx"
+#include "io/FileMapping.hxx"
+#include "system/Error.hxx"
+#include "util/SpanCast.hxx"
+#include "Log.hxx"
+
+#include <algorithm> // for std::clamp()
+#include <cassert>
+
+class SharedJournal::Cursor final : public ScrobblerJournal {
+	SharedJournal &shared;
+
+	const std::string name;
+
+	const IgnoreList *const ignore_list;
+
+	/**
+	 * The sequence number of the oldest record which has not
+	 * been submitted.
+	 */
+	uint_least64_t position;
+
+	/**
+	 * The sequence numbers of the records which have not been
+	 * acknowledged (in the order of the scrobbler's queue).
+	 */
+	std::deque<uint_least64_t> seqs;
+
+public:
+	Cursor(SharedJournal &_shared, std::string_view _name,
+	       const IgnoreList *_ignore_list,
+	       uint_least64_t _position) noexcept
+		:shared(_shared), name(_name), ignore_list(_ignore_list),
+		 position(_position) {}
+
+	~Cursor() noexcept override {
+		shared.cursors.erase(name);
+	}
+
+	const std::string &GetName() const noexcept {
+		return name;
+	}
+
+	uint_least64_t GetPosition() const noexcept {
+		return position;
+	}
+
+	/* virtual methods from class ScrobblerJournal */
+	const std::string &GetPath() const noexcept override {
+		return shared.journal.GetPath();
+	}
+
+	JournalBacklog Read() override;
+
+	void Append(const Record &record) noexcept override {
+		seqs.push_back(shared.Append(record));
+	}
+
+	void Acknowledge(unsigned n) noexcept override {
+		assert(n > 0);
+
+		RemoveOldest(seqs, n);
+		position = seqs.empty() ? shared.end : seqs.front();
+		shared.WriteCursor(name, position);
+	}
+
+	unsigned GetGeneration() const noexcept override {
+		return shared.journal.GetGeneration();
+	}
+
+	bool NeedsCompaction(bool eager) const noexcept override {
+		return shared.NeedsCompaction(eager);
+	}
+
+	bool Compact(const RecordQueue &, const JournalBacklog *,
+		     const RecordSpill *) noexcept override {
+		/* the records are copied from the file, because the
+		   other scrobblers may still need older ones */
+		return shared.Compact();
+	}
+};
+
+JournalBacklog
+SharedJournal::Cursor::Read()
+{
+	seqs.clear();
+
+	auto mapping = shared.mapping;
+	const SharedJournalIndex *index = &shared.index;
+
+	SharedJournalIndex current_index;
+	if (mapping == nullptr && position < shared.end) {
+		/* the file loaded at startup has been released by
+		   FinishOpen(): load the current one, after the
+		   running compaction (if any) has finished writing
+		   it */
+		shared.journal.WaitCompaction();
+
+		mapping = std::make_shared<FileMapping>(GetPath().c_str());
+		const auto src = mapping->get();
+		if (!src.empty() && binary_journal_check_header(src))
+			binary_journal_index_shared(GetPath().c_str(), src,
+						    current_index);
+		index = &current_index;
+	}
+
+	if (mapping == nullptr)
+		return {};
+
+	const auto src = mapping->get();
+
+	std::deque<std::size_t> offsets;
+
+	for (std::size_t i = 0; i < index->offsets.size(); ++i) {
+		const uint_least64_t seq = index->seqs[i];
+		if (seq < position)
+			continue;
+
+		if (ignore_list != nullptr) {
+			/* the other scrobblers may have stored records
+			   which this one ignores */
+			RecordQueue tmp;
+			if (binary_journal_decode(src, index->offsets[i], tmp) &&
+			    ignore_list->matches_record(*tmp.front()))
+				continue;
+		}
+
+		offsets.push_back(index->offsets[i]);
+		seqs.push_back(seq);
+	}
+
+	return {std::move(mapping), true, std::move(offsets)};
+}
+
+SharedJournal::SharedJournal(EventLoop &event_loop, std::string_view path)
+	:journal(event_loop, path, JournalFormat::BINARY)
+{
+	try {
+		mapping = std::make_shared<FileMapping>(journal.GetPath().c_str());
+	} catch (const std::system_error &e) {
+		if (IsFileNotFound(e))
+			/* the first start with a shared journal */
+			return;
+
+		throw;
+	}
+
+	const auto src = mapping->get();
+	if (src.empty())
+		return;
+
+	if (!binary_journal_check_header(src))
+		throw FmtRuntimeError("{:?} is not a binary journal", path);
+
+	const bool complete =
+		binary_journal_index_shared(journal.GetPath().c_str(), src,
+					    index);
+	base = index.base;
+	end = index.end;
+
+	if (!complete)
+		/* rewrite the file before new frames are appended
+		   after the garbage */
+		Compact(src, index, base, index.cursors);
+}
+
+SharedJournal::~SharedJournal() noexcept
+{
+	assert(cursors.empty());
+}
+
+std::unique_ptr<ScrobblerJournal>
+SharedJournal::Open(std::string_view name, const IgnoreList *ignore_list)
+{
+	if (cursors.contains(name))
+		throw FmtRuntimeError("Duplicate scrobbler {:?} in shared journal {:?}",
+				      name, journal.GetPath());
+
+	uint_least64_t position = end;
+	const auto i = index.cursors.find(name);
+	if (i != index.cursors.end())
+		position = std::clamp(i->second, base, end);
+
+	auto cursor = std::make_unique<Cursor>(*this, name, ignore_list,
+					       position);
+	cursors.emplace(name, cursor.get());
+
+	if (i == index.cursors.end())
+		/* a new scrobbler: make its cursor durable, or else
+		   a restart would not know where it started */
+		WriteCursor(name, position);
+
+	return cursor;
+}
+
+void
+SharedJournal::FinishOpen() noexcept
+{
+	/* cursors of scrobblers which are not configured anymore
+	   are dropped by the next compaction */
+	for (const auto &[name, position] : index.cursors)
+		if (!cursors.contains(name))
+			FmtInfo("Forgetting scrobbler {:?} in shared journal {:?}",
+				name, journal.GetPath());
+
+	index = {};
+	mapping.reset();
+}
+
+uint_least64_t
+SharedJournal::Append(const Record &record) noexcept
+{
+	std::string frame;
+	binary_journal_encode_record(frame, record);
+
+	if (&record == last_record && frame == last_frame)
+		/* another scrobbler has just appended this record */
+		return end - 1;
+
+	journal.Write(frame);
+	last_record = &record;
+	last_frame = std::move(frame);
+	return end++;
+}
+
+void
+SharedJournal::WriteCursor(std::string_view name, uint_least64_t seq) noexcept
+{
+	std::string entry;
+	binary_journal_encode_cursor(entry, name, seq);
+	journal.Write(entry);
+
+	++n_cursor_entries;
+}
+
+uint_least64_t
+SharedJournal::GetMinCursor() const noexcept
+{
+	uint_least64_t min = end;
+	for (const auto &[name, cursor] : cursors)
+		min = std::min(min, cursor->GetPosition());
+	return min;
+}
+
+bool
+SharedJournal::NeedsCompaction(bool eager) const noexcept
+{
+	return (GetMinCursor() - base) + n_cursor_entries >=
+		(eager ? 1 : COMPACT_THRESHOLD);
+}
+
+bool
+SharedJournal::Compact() noexcept
+{
+	if (journal.IsCompacting())
+		return false;
+
+	std::map<std::string, uint_least64_t, std::less<>> positions;
+	for (const auto &[name, cursor] : cursors)
+		positions.emplace(name, cursor->GetPosition());
+
+	/* read the records back from the file; there is no
+	   compaction running, so it is complete */
+	try {
+		const FileMapping current{journal.GetPath().c_str()};
+		const auto src = current.get();
+
+		SharedJournalIndex current_index;
+		if (!src.empty() && binary_journal_check_header(src))
+			binary_journal_index_shared(journal.GetPath().c_str(),
+						    src, current_index);
+
+		return Compact(src, current_index, GetMinCursor(), positions);
+	} catch (...) {
+		FmtError("Failed to save {:?}: {}",
+			 journal.GetPath(), std::current_exception());
+		return false;
+	}
+}
+
+bool
+SharedJournal::Compact(std::span<const std::byte> src,
+		       const SharedJournalIndex &src_index,
+		       uint_least64_t min,
+		       const std::map<std::string, uint_least64_t, std::less<>> &positions) noexcept
+{
+	std::string contents;
+	binary_journal_encode_header(contents);
+	binary_journal_encode_base(contents, min);
+
+	/* the frames are copied verbatim; corrupt records are
+	   replaced by empty ones (which are skipped by the reader),
+	   so the sequence numbers of the following records do not
+	   change */
+	const Record empty{"", "", "", "", "", {}, {}, false, false};
+
+	uint_least64_t seq = min;
+	for (std::size_t i = 0; i < src_index.offsets.size(); ++i) {
+		if (src_index.seqs[i] < min)
+			continue;
+
+		for (; seq < src_index.seqs[i]; ++seq)
+			binary_journal_encode_record(contents, empty);
+
+		contents.append(ToStringView(binary_journal_get_frame(src, src_index.offsets[i])));
+		++seq;
+	}
+
+	for (; seq < src_index.end; ++seq)
+		binary_journal_encode_record(contents, empty);
+
+	for (const auto &[name, position] : positions)
+		binary_journal_encode_cursor(contents, name, position);
+
+	if (!journal.Replace(std::move(contents)))
+		return false;
+
+	base = min;
+	n_cursor_entries = 0;
+	return true;
+}
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef SHARED_JOURNAL_HXX
+#define SHARED_JOURNAL_HXX
+
+#include "BinaryJournal.hxx"
+#include "Journal.hxx"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct IgnoreList;
+class FileMapping;
+
+/**
+ * A journal file (in the binary format) which is shared by several
+ * scrobblers: each record is stored only once, no matter how many
+ * scrobblers submit it, and each scrobbler has a "cursor" (see
+ * Open()) which remembers how far it has got.  Records are dropped
+ * by the next compaction as soon as all cursors have passed them.
+ *
+ * Records are identified by a sequence number which increases by
+ * one for each record appended to the file.  A cursor is the
+ * sequence number of the oldest record the scrobbler has not
+ * submitted yet.
+ */
+class SharedJournal {
+	/**
+	 * Compact the file after this many records have been
+	 * passed by all cursors or this many cursor entries have
+	 * been written.
+	 */
+	static constexpr unsigned COMPACT_THRESHOLD = 256;
+
+	class Cursor;
+
+	/**
+	 * Does the file I/O: appending and the atomic replacement.
+	 */
+	Journal journal;
+
+	/**
+	 * The file as it was loaded at startup and its index.  They
+	 * are only needed by Open(), and are released by
+	 * FinishOpen() (the mapping itself lives on in the
+	 * #JournalBacklog instances).
+	 */
+	std::shared_ptr<const FileMapping> mapping;
+	SharedJournalIndex index;
+
+	/**
+	 * The sequence number of the first record in the file.
+	 */
+	uint_least64_t base = 0;
+
+	/**
+	 * The sequence number of the next record to be appended.
+	 */
+	uint_least64_t end = 0;
+
+	/**
+	 * The open cursors by scrobbler name.
+	 */
+	std::map<std::string, Cursor *, std::less<>> cursors;
+
+	/**
+	 * The last record passed to Append() and its encoded frame.
+	 * All scrobblers append the same #Record object, and it is
+	 * stored only once.
+	 */
+	const Record *last_record = nullptr;
+	std::string last_frame;
+
+	/**
+	 * The number of cursor entries written since the last
+	 * compaction.
+	 */
+	unsigned n_cursor_entries = 0;
+
+public:
+	/**
+	 * Load the file.  Throws on error.
+	 */
+	SharedJournal(EventLoop &event_loop, std::string_view path);
+
+	~SharedJournal() noexcept;
+
+	SharedJournal(const SharedJournal &) = delete;
+	SharedJournal &operator=(const SharedJournal &) = delete;
+
+	/**
+	 * Open the cursor of the given scrobbler.  A scrobbler which
+	 * was not known yet starts with the next record.  Throws on
+	 * error.
+	 *
+	 * The scrobbler must append all records except those
+	 * matching its ignore list, because the cursor only says
+	 * where it is, not which records it has taken.
+	 *
+	 * @param ignore_list records matching this list are skipped
+	 * when loading the file (optional)
+	 */
+	std::unique_ptr<ScrobblerJournal> Open(std::string_view name,
+					       const IgnoreList *ignore_list);
+
+	/**
+	 * All cursors have been opened: release the index which was
+	 * loaded for Open().
+	 */
+	void FinishOpen() noexcept;
+
+private:
+	/**
+	 * Append a record (unless it was appended right before by
+	 * another cursor).
+	 *
+	 * @return the sequence number of the record
+	 */
+	uint_least64_t Append(const Record &record) noexcept;
+
+	void WriteCursor(std::string_view name, uint_least64_t seq) noexcept;
+
+	[[gnu::pure]]
+	uint_least64_t GetMinCursor() const noexcept;
+
+	[[gnu::pure]]
+	bool NeedsCompaction(bool eager) const noexcept;
+
+	/**
+	 * Start rewriting the file with only the records which have
+	 * not been passed by all cursors.
+	 */
+	bool Compact() noexcept;
+
+	/**
+	 * Rewrite the file from the given index of the current file,
+	 * keeping only records from #min on.
+	 */
+	bool Compact(std::span<const std::byte> src,
+		     const SharedJournalIndex &src_index,
+		     uint_least64_t min,
+		     const std::map<std::string, uint_least64_t, std::less<>> &positions) noexcept;
+};
+
+#endif
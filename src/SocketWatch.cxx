@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "SocketWatch.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "system/Error.hxx"
+
+#include <cstddef> // for std::byte
+#include <cstring>
+#include <string_view>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+SocketWatch::SocketWatch(EventLoop &event_loop, const char *path,
+			 Callback _callback)
+	:callback(_callback),
+	 name(std::string_view{path}.substr(std::string_view{path}.rfind('/') + 1)),
+	 event(event_loop, BIND_THIS_METHOD(OnInotifyReady))
+{
+	const std::string_view p{path};
+	const auto slash = p.rfind('/');
+	const std::string directory{slash > 0 ? p.substr(0, slash) : "/"};
+
+	const int fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (fd < 0)
+		throw MakeErrno("inotify_init1() failed");
+
+	if (inotify_add_watch(fd, directory.c_str(),
+			      IN_CREATE|IN_MOVED_TO|IN_ONLYDIR) < 0) {
+		const int e = errno;
+		close(fd);
+		throw FmtErrno(e, "Failed to watch {:?}", directory);
+	}
+
+	event.Open(SocketDescriptor(fd));
+	event.ScheduleRead();
+}
+
+void
+SocketWatch::OnInotifyReady(unsigned) noexcept
+{
+	alignas(struct inotify_event) std::byte buffer[4096];
+
+	bool found = false;
+
+	ssize_t nbytes;
+	while ((nbytes = read(event.GetSocket().Get(), buffer,
+			      sizeof(buffer))) > 0) {
+		for (const std::byte *p = buffer, *end = p + nbytes; p < end;) {
+			const auto &e = *(const struct inotify_event *)p;
+			p += sizeof(e) + e.len;
+
+			if ((e.len > 0 && name == e.name) ||
+			    /* events were lost; maybe ours was one
+			       of them */
+			    (e.mask & IN_Q_OVERFLOW) != 0)
+				found = true;
+		}
+	}
+
+	if (found)
+		callback();
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef SOCKET_WATCH_HXX
+#define SOCKET_WATCH_HXX
+
+#include "event/SocketEvent.hxx"
+#include "util/BindMethod.hxx"
+
+#include <string>
+
+/**
+ * Watches the directory of a local socket with inotify and invokes
+ * the callback when the socket is created, i.e. when the server has
+ * (re)started.  The directory is watched and not the socket itself,
+ * because the socket does not exist while the server is down.
+ */
+class SocketWatch {
+	using Callback = BoundMethod<void() noexcept>;
+	const Callback callback;
+
+	/**
+	 * The file name of the socket within the watched directory.
+	 */
+	const std::string name;
+
+	/**
+	 * The inotify file descriptor.
+	 */
+	SocketEvent event;
+
+public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param path the absolute path of the socket
+	 */
+	SocketWatch(EventLoop &event_loop, const char *path,
+		    Callback _callback);
+
+	~SocketWatch() noexcept {
+		event.Close();
+	}
+
+	SocketWatch(const SocketWatch &) = delete;
+	SocketWatch &operator=(const SocketWatch &) = delete;
+
+private:
+	void OnInotifyReady(unsigned events) noexcept;
+};
+
+#endif
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "StringPool.hxx"
+
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <unordered_set>
+
+struct PooledString::Item {
+	unsigned ref = 1;
+
+	const std::size_t length;
+
+	/* the value follows this struct (null-terminated) */
+
+	explicit Item(std::size_t _length) noexcept
+		:length(_length) {}
+
+	char *GetValue() noexcept {
+		return reinterpret_cast<char *>(this + 1);
+	}
+
+	std::string_view GetView() noexcept {
+		return {GetValue(), length};
+	}
+
+	static Item *Create(std::string_view value) noexcept {
+		void *p = ::operator new(sizeof(Item) + value.size() + 1);
+		auto *item = new(p) Item(value.size());
+		char *dest = item->GetValue();
+		std::memcpy(dest, value.data(), value.size());
+		dest[value.size()] = 0;
+		return item;
+	}
+
+	void Destroy() noexcept {
+		this->~Item();
+		::operator delete(this);
+	}
+};
+
+namespace {
+
+struct ItemHash {
+	using is_transparent = void;
+
+	[[gnu::pure]]
+	std::size_t operator()(std::string_view value) const noexcept {
+		return std::hash<std::string_view>{}(value);
+	}
+
+	[[gnu::pure]]
+	std::size_t operator()(PooledString::Item *item) const noexcept {
+		return (*this)(item->GetView());
+	}
+};
+
+struct ItemEqual {
+	using is_transparent = void;
+
+	[[gnu::pure]]
+	static std::string_view ToView(std::string_view value) noexcept {
+		return value;
+	}
+
+	[[gnu::pure]]
+	static std::string_view ToView(PooledString::Item *item) noexcept {
+		return item->GetView();
+	}
+
+	template<typename A, typename B>
+	[[gnu::pure]]
+	bool operator()(const A &a, const B &b) const noexcept {
+		return ToView(a) == ToView(b);
+	}
+};
+
+} // anonymous namespace
+
+static std::unordered_set<PooledString::Item *, ItemHash, ItemEqual> pool;
+
+PooledString::PooledString(std::string_view value) noexcept
+{
+	if (value.empty())
+		return;
+
+	if (auto i = pool.find(value); i != pool.end()) {
+		item = *i;
+		++item->ref;
+	} else {
+		item = Item::Create(value);
+		pool.emplace(item);
+	}
+}
+
+PooledString::PooledString(const PooledString &src) noexcept
+	:item(src.item)
+{
+	if (item != nullptr)
+		++item->ref;
+}
+
+std::string_view
+PooledString::view() const noexcept
+{
+	if (item == nullptr)
+		return {"", 0};
+
+	return item->GetView();
+}
+
+void
+PooledString::Release() noexcept
+{
+	if (item == nullptr)
+		return;
+
+	assert(item->ref > 0);
+
+	if (--item->ref == 0) {
+		pool.erase(item);
+		item->Destroy();
+	}
+
+	item = nullptr;
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef STRING_POOL_HXX
+#define STRING_POOL_HXX
+
+#include <string_view>
+#include <utility>
+
+/**
+ * A reference to an interned string.  All #PooledString instances
+ * with the same value share one allocation in a global pool, which
+ * is freed when the last reference is gone.  This is used for
+ * values which repeat many times in a large queue (e.g. artist and
+ * album names).
+ *
+ * This class is not thread-safe.
+ */
+class PooledString {
+public:
+	/**
+	 * An entry in the pool (opaque, see StringPool.cxx).
+	 */
+	struct Item;
+
+private:
+	Item *item = nullptr;
+
+public:
+	PooledString() noexcept = default;
+
+	/**
+	 * Look up the given value in the pool (or add it).  The empty
+	 * string is represented without an allocation.
+	 */
+	explicit PooledString(std::string_view value) noexcept;
+
+	PooledString(const PooledString &src) noexcept;
+
+	PooledString(PooledString &&src) noexcept
+		:item(std::exchange(src.item, nullptr)) {}
+
+	~PooledString() noexcept {
+		Release();
+	}
+
+	PooledString &operator=(PooledString src) noexcept {
+		std::swap(item, src.item);
+		return *this;
+	}
+
+	bool empty() const noexcept {
+		return item == nullptr;
+	}
+
+	/**
+	 * Returns the value.  It is guaranteed to be null-terminated.
+	 */
+	[[gnu::pure]]
+	std::string_view view() const noexcept;
+
+	[[gnu::pure]]
+	const char *c_str() const noexcept {
+		return view().data();
+	}
+
+	operator std::string_view() const noexcept {
+		return view();
+	}
+
+private:
+	void Release() noexcept;
+};
+
+#endif
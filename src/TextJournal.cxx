@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "TextJournal.hxx"
+#include "Record.hxx"
+#include "util/StringSplit.hxx"
+#include "util/StringStrip.hxx"
+
+#include <fmt/format.h>
+
+#include <iterator> // for std::back_inserter()
+#include <string>
+
+#include <stdlib.h>
+
+static void
+journal_write_string(std::string &dest, char field, std::string_view value)
+{
+	if (!value.empty())
+		fmt::format_to(std::back_inserter(dest), "{} = {}\n", field, value);
+}
+
+void
+text_journal_encode_record(std::string &dest, const Record &record)
+{
+	journal_write_string(dest, 'a', record.GetArtist());
+	journal_write_string(dest, 't', record.GetTrack());
+	journal_write_string(dest, 'b', record.GetAlbum());
+	journal_write_string(dest, 'n', record.GetNumber());
+	journal_write_string(dest, 'm', record.GetMbid());
+	if (record.IsLoved())
+		journal_write_string(dest, 'r', "L");
+	if (record.GetTimestamp() != 0)
+		fmt::format_to(std::back_inserter(dest), "i = {}\n",
+			       record.GetTimestamp());
+
+	fmt::format_to(std::back_inserter(dest), "l = {}\no = {}\n\n",
+		       record.GetLength().count(),
+		       record.GetSource());
+}
+
+void
+text_journal_encode_ack(std::string &dest, unsigned n)
+{
+	fmt::format_to(std::back_inserter(dest), "ack = {}\n\n", n);
+}
+
+/**
+ * Split the first line off the source.  The newline character is
+ * not part of the returned line.
+ */
+static std::string_view
+NextLine(std::string_view &src) noexcept
+{
+	const auto [line, rest] = Split(src, '\n');
+	src = rest;
+	return line;
+}
+
+/**
+ * Parse a "key = value" line.
+ *
+ * @return false if the line is empty, a comment or malformed
+ */
+static bool
+ParseLine(std::string_view line,
+	  std::string_view &key_r, std::string_view &value_r) noexcept
+{
+	line = StripLeft(line);
+	if (line.empty() || line.front() == '#')
+		return false;
+
+	const auto eq = line.find('=');
+	if (eq == line.npos || eq == 0)
+		return false;
+
+	key_r = StripRight(line.substr(0, eq));
+	value_r = Strip(line.substr(eq + 1));
+	return true;
+}
+
+void
+text_journal_index(std::string_view src, std::deque<std::size_t> &offsets_r,
+		   unsigned &n_acked_r) noexcept
+{
+	const char *const begin = src.data();
+
+	n_acked_r = 0;
+
+	/* the record being scanned; it is only indexed if it has an
+	   artist and a track title, just like TextRecord::Commit()
+	   does */
+	std::size_t offset = 0;
+	bool has_artist = false, has_track = false;
+
+	const auto commit = [&](){
+		if (has_artist && has_track)
+			offsets_r.push_back(offset);
+
+		has_artist = has_track = false;
+	};
+
+	while (!src.empty()) {
+		const std::size_t position = src.data() - begin;
+
+		std::string_view key, value;
+		if (!ParseLine(NextLine(src), key, value))
+			continue;
+
+		if (key == "a") {
+			commit();
+			offset = position;
+			has_artist = !value.empty();
+		} else if (key == "t")
+			has_track = !value.empty();
+		else if (key == "ack") {
+			commit();
+
+			const std::size_t n = strtoul(std::string{value}.c_str(),
+						      nullptr, 10);
+			n_acked_r += RemoveOldest(offsets_r, n);
+		}
+	}
+
+	commit();
+}
+
+namespace {
+
+/**
+ * The fields of a record being parsed from a text journal.
+ */
+struct TextRecord {
+	std::string artist, track, album, number, mbid;
+	int_least64_t time = 0;
+	std::chrono::seconds length{};
+	bool love = false, radio = false;
+
+	void Set(std::string_view key, std::string_view value) noexcept {
+		if (key == "a")
+			artist = value;
+		else if (key == "t")
+			track = value;
+		else if (key == "b")
+			album = value;
+		else if (key == "n")
+			number = value;
+		else if (key == "m")
+			mbid = value;
+		else if (key == "i")
+			time = strtoll(std::string{value}.c_str(), nullptr, 10);
+		else if (key == "l")
+			length = std::chrono::seconds(atoi(std::string{value}.c_str()));
+		else if (key == "o" && value.starts_with('R'))
+			radio = true;
+		else if (key == "r" && value.starts_with('L'))
+			love = true;
+	}
+
+	/**
+	 * Append the record to the queue (if it is complete).
+	 */
+	bool Commit(RecordQueue &queue) const noexcept {
+		if (artist.empty() || track.empty())
+			return false;
+
+		queue.emplace_back(std::make_shared<const Record>(artist, track,
+								  album, number, mbid,
+								  std::chrono::sys_seconds{std::chrono::seconds{time}},
+								  length, love, radio));
+		return true;
+	}
+};
+
+} // anonymous namespace
+
+bool
+text_journal_decode(std::string_view src, std::size_t offset,
+		    RecordQueue &queue) noexcept
+{
+	if (offset >= src.size())
+		return false;
+
+	src = src.substr(offset);
+
+	TextRecord record;
+	bool first = true;
+
+	while (!src.empty()) {
+		std::string_view key, value;
+		if (!ParseLine(NextLine(src), key, value))
+			continue;
+
+		if (key == "ack" || (key == "a" && !first))
+			/* end of this record */
+			break;
+
+		record.Set(key, value);
+		first = false;
+	}
+
+	return record.Commit(queue);
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef TEXT_JOURNAL_HXX
+#define TEXT_JOURNAL_HXX
+
+/*
+ * The text journal format.  Each record is a block of "key = value"
+ * lines beginning with the artist ("a"); an "ack = N" line removes
+ * the N oldest records.
+ */
+
+#include "RecordQueue.hxx"
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+
+/**
+ * Append a record to the given buffer.
+ */
+void
+text_journal_encode_record(std::string &dest, const Record &record);
+
+void
+text_journal_encode_ack(std::string &dest, unsigned n);
+
+/**
+ * Scan a text journal and replay it, but only collect the file
+ * offsets of the records which have not been acknowledged instead of
+ * decoding them.
+ *
+ * @param offsets_r receives the offsets (oldest first)
+ * @param n_acked_r receives the number of acknowledged records
+ * which are still in the file
+ */
+void
+text_journal_index(std::string_view src, std::deque<std::size_t> &offsets_r,
+		   unsigned &n_acked_r) noexcept;
+
+/**
+ * Decode the record at the given offset (obtained from
+ * text_journal_index()) and append it to the queue.
+ *
+ * @return false if there is no valid record at this offset
+ */
+bool
+text_journal_decode(std::string_view src, std::size_t offset,
+		    RecordQueue &queue) noexcept;
+
+#endif
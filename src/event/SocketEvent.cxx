@@ -21,8 +21,6 @@ SocketEvent::Open(SocketDescriptor _fd) noexcept
 	fd = _fd;
 }
 
-#if 0 // not used by mpdscribble
-
 void
 SocketEvent::Close() noexcept
 {
@@ -47,8 +45,6 @@ SocketEvent::Close() noexcept
 	fd.Close();
 }
 
-#endif
-
 void
 SocketEvent::Abandon() noexcept
 {
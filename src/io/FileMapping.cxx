@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "FileMapping.hxx"
+#include "FileReader.hxx"
+#include "lib/fmt/SystemError.hxx"
+
+#include <algorithm> // for std::copy_n()
+
+#ifndef _WIN32
+#include "Open.hxx"
+#include "UniqueFileDescriptor.hxx"
+
+#include <sys/mman.h>
+#endif
+
+#ifdef _WIN32
+
+FileMapping::FileMapping(const char *path)
+{
+	FileReader reader{path};
+
+	std::size_t capacity = 0;
+	for (;;) {
+		if (size == capacity) {
+			capacity = capacity > 0 ? capacity * 2 : 65536;
+			auto new_buffer = std::make_unique<std::byte[]>(capacity);
+			std::copy_n(buffer.get(), size, new_buffer.get());
+			buffer = std::move(new_buffer);
+		}
+
+		std::size_t nbytes = reader.Read({buffer.get() + size,
+						  capacity - size});
+		if (nbytes == 0)
+			break;
+
+		size += nbytes;
+	}
+
+	data = buffer.get();
+}
+
+FileMapping::~FileMapping() noexcept = default;
+
+#else
+
+FileMapping::FileMapping(const char *path)
+{
+	const auto fd = OpenReadOnly(path);
+
+	const off_t file_size = fd.GetSize();
+	if (file_size < 0)
+		throw FmtErrno("Failed to get size of {:?}", path);
+
+	if (file_size == 0)
+		/* mmap() doesn't accept zero-length mappings */
+		return;
+
+	void *p = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE,
+		       fd.Get(), 0);
+	if (p == MAP_FAILED)
+		throw FmtErrno("Failed to map {:?}", path);
+
+	data = (const std::byte *)p;
+	size = file_size;
+}
+
+FileMapping::~FileMapping() noexcept
+{
+	if (data != nullptr)
+		munmap(const_cast<std::byte *>(data), size);
+}
+
+#endif
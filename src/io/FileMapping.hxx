@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+
+/**
+ * A read-only view of a whole file.  On POSIX, the file is mapped
+ * with mmap(); on Windows, it is read into a heap buffer.
+ */
+class FileMapping {
+#ifdef _WIN32
+	std::unique_ptr<std::byte[]> buffer;
+#endif
+
+	const std::byte *data = nullptr;
+	std::size_t size = 0;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	explicit FileMapping(const char *path);
+
+	~FileMapping() noexcept;
+
+	FileMapping(const FileMapping &) = delete;
+	FileMapping &operator=(const FileMapping &) = delete;
+
+	std::span<const std::byte> get() const noexcept {
+		return {data, size};
+	}
+};
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef CURL_HTTP_STATUS_ERROR_HXX
+#define CURL_HTTP_STATUS_ERROR_HXX
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+/**
+ * The server has responded with an HTTP error status.  The response
+ * body is preserved because some APIs describe the error there.
+ */
+class HttpStatusError final : public std::runtime_error {
+	unsigned status;
+
+	std::string body;
+
+	/**
+	 * The value of the "Retry-After" response header (zero if
+	 * there is none).
+	 */
+	std::chrono::seconds retry_after;
+
+public:
+	HttpStatusError(unsigned _status, std::string &&_body,
+			const char *_msg,
+			std::chrono::seconds _retry_after={}) noexcept
+		:std::runtime_error(_msg),
+		 status(_status), body(std::move(_body)),
+		 retry_after(_retry_after) {}
+
+	unsigned GetStatus() const noexcept {
+		return status;
+	}
+
+	const std::string &GetBody() const noexcept {
+		return body;
+	}
+
+	std::chrono::seconds GetRetryAfter() const noexcept {
+		return retry_after;
+	}
+};
+
+#endif
@@ -4,11 +4,14 @@
 #include "Request.hxx"
 #include "Handler.hxx"
 #include "Global.hxx"
+#include "HttpStatusError.hxx"
 #include "lib/fmt/RuntimeError.hxx"
 #include "config.h"
 
 #include <curl/curl.h>
 
+#include <fmt/format.h>
+
 #include <stdexcept>
 
 enum {
@@ -18,17 +21,25 @@ enum {
 
 CurlRequest::CurlRequest(CurlGlobal &_global,
 			 const char *url, std::string &&_request_body,
-			 HttpResponseHandler &_handler)
+			 CurlSlist &&_request_headers,
+			 HttpResponseHandler &_handler,
+			 std::chrono::duration<long> timeout)
 	:global(_global),
 	 handler(_handler),
 	 curl(url),
+	 request_headers(std::move(_request_headers)),
 	 request_body(std::move(_request_body))
 {
 	curl.SetPrivate(this);
 	curl.SetUserAgent(PACKAGE "/" VERSION);
 	curl.SetWriteFunction(WriteFunction, this);
 	curl.SetOption(CURLOPT_ERRORBUFFER, error);
-	curl.SetFailOnError();
+
+	if (timeout.count() > 0)
+		curl.SetTimeout(timeout);
+
+	if (request_headers.Get() != nullptr)
+		curl.SetRequestHeaders(request_headers.Get());
 
 	if (!request_body.empty()) {
 		curl.SetOption(CURLOPT_POST, true);
@@ -56,6 +67,22 @@ CurlRequest::CheckResponse(CURLcode result)
 		throw std::runtime_error("response body is too large");
 	else if (result != CURLE_OK)
 		throw FmtRuntimeError("CURL failed: {}", error);
+
+	long status = 0;
+	curl.GetInfo(CURLINFO_RESPONSE_CODE, &status);
+	if (status >= 400) {
+		std::chrono::seconds retry_after{};
+#if LIBCURL_VERSION_NUM >= 0x074200
+		/* CURLINFO_RETRY_AFTER was added in 7.66.0 */
+		curl_off_t value;
+		if (curl.GetInfo(CURLINFO_RETRY_AFTER, &value) && value > 0)
+			retry_after = std::chrono::seconds{value};
+#endif
+
+		const auto msg = fmt::format("HTTP status {}", status);
+		throw HttpStatusError(status, std::move(response_body),
+				      msg.c_str(), retry_after);
+	}
 }
 
 void
@@ -5,7 +5,9 @@
 #define CURL_REQUEST_HXX
 
 #include "Easy.hxx"
+#include "Slist.hxx"
 
+#include <chrono>
 #include <string>
 
 class CurlGlobal;
@@ -24,6 +26,9 @@ class CurlRequest final
 	/** the CURL easy handle */
 	CurlEasy curl;
 
+	/** additional request headers */
+	CurlSlist request_headers;
+
 	/** the POST request body */
 	std::string request_body;
 
@@ -34,9 +39,23 @@ class CurlRequest final
 	char error[CURL_ERROR_SIZE];
 
 public:
+	CurlRequest(CurlGlobal &_global,
+		    const char *url, std::string &&_request_body,
+		    HttpResponseHandler &_handler)
+		:CurlRequest(_global, url, std::move(_request_body), {},
+			     _handler) {}
+
+	/**
+	 * @param _request_headers additional request headers (each
+	 * one formatted as "Name: value")
+	 * @param timeout the maximum duration of the whole request;
+	 * zero means no limit
+	 */
 	CurlRequest(CurlGlobal &global,
 		    const char *url, std::string &&_request_body,
-		    HttpResponseHandler &_handler);
+		    CurlSlist &&_request_headers,
+		    HttpResponseHandler &_handler,
+		    std::chrono::duration<long> timeout={});
 	~CurlRequest() noexcept;
 
 	CURL *Get() noexcept {
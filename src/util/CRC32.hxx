@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace CRC32Detail {
+
+static constexpr auto
+GenerateTable() noexcept
+{
+	std::array<uint_least32_t, 256> table{};
+
+	for (uint_least32_t i = 0; i < table.size(); ++i) {
+		uint_least32_t c = i;
+		for (unsigned k = 0; k < 8; ++k)
+			c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		table[i] = c;
+	}
+
+	return table;
+}
+
+inline constexpr auto table = GenerateTable();
+
+} // namespace CRC32Detail
+
+/**
+ * Calculate the CRC-32 (IEEE 802.3) checksum of the given buffer.
+ */
+[[gnu::pure]]
+constexpr uint_least32_t
+CRC32(std::span<const std::byte> src) noexcept
+{
+	uint_least32_t c = 0xffffffff;
+	for (const std::byte b : src)
+		c = CRC32Detail::table[(c ^ static_cast<uint_least32_t>(b)) & 0xff] ^ (c >> 8);
+	return c ^ 0xffffffff;
+}
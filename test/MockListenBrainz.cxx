@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "MockListenBrainz.hxx"
+#include "TestUtil.hxx"
+#include "ScrobblerConfig.hxx"
+#include "event/Loop.hxx"
+
+#include <fmt/core.h>
+
+#include <thread>
+
+MockListenBrainz::MockListenBrainz()
+	:server([this](const StandInServer::Request &request){
+		return HandleRequest(request);
+	})
+{
+}
+
+void
+MockListenBrainz::Configure(ScrobblerConfig &config) const noexcept
+{
+	config.name = "test";
+	config.protocol = ScrobblerProtocol::LISTENBRAINZ;
+	config.url = server.GetUrl("/");
+	config.token = TOKEN;
+	config.ignore_list = nullptr;
+}
+
+std::vector<MockListenBrainz::ReceivedRequest>
+MockListenBrainz::GetRequests() const noexcept
+{
+	const std::scoped_lock lock{mutex};
+	return requests;
+}
+
+unsigned
+MockListenBrainz::CountListens() const noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	unsigned n = 0;
+	for (const auto &i : requests)
+		n += i.n_listens;
+	return n;
+}
+
+void
+MockListenBrainz::CheckErrors() const noexcept
+{
+	const std::scoped_lock lock{mutex};
+	for (const auto &i : errors)
+		Check(false, i.c_str());
+}
+
+StandInServer::Response
+MockListenBrainz::HandleRequest(const StandInServer::Request &request) noexcept
+{
+	if (request.body.find("\"import\"") != request.body.npos)
+		/* a slow backlog submission must not delay the "now
+		   playing" notification */
+		std::this_thread::sleep_for(std::chrono::milliseconds{500});
+
+	const std::scoped_lock lock{mutex};
+
+	if (request.method != "POST" || request.path != "/1/submit-listens") {
+		errors.emplace_back("wrong request line");
+		return {404, "application/json",
+			"{\"code\": 404, \"error\": \"Not found\"}"};
+	}
+
+	const auto authorization = request.headers.find("authorization");
+	if (authorization == request.headers.end() ||
+	    authorization->second != fmt::format("Token {}", TOKEN)) {
+		errors.emplace_back("wrong token");
+		return {401, "application/json",
+			"{\"code\": 401, \"error\": \"Invalid authorization token.\"}"};
+	}
+
+	const auto content_type = request.headers.find("content-type");
+	if (content_type == request.headers.end() ||
+	    content_type->second != "application/json")
+		errors.emplace_back("wrong content type");
+
+	std::string_view body = request.body;
+	const std::string_view prefix = "{\"listen_type\":\"";
+	if (!body.starts_with(prefix)) {
+		errors.emplace_back("malformed JSON");
+		return {400, "application/json",
+			"{\"code\": 400, \"error\": \"Invalid JSON document submitted.\"}"};
+	}
+
+	body.remove_prefix(prefix.size());
+	const std::string listen_type{body.substr(0, body.find('"'))};
+
+	if (body.find("Poison") != body.npos)
+		/* a song which is always rejected */
+		return {400, "application/json",
+			"{\"code\": 400, \"error\": \"Invalid listen.\"}"};
+
+	unsigned n_listens = 0;
+	for (std::size_t i = 0;
+	     (i = body.find("\"track_metadata\"", i)) != body.npos;
+	     ++i)
+		++n_listens;
+
+	const bool has_timestamp = body.find("\"listened_at\"") != body.npos;
+	if (has_timestamp == (listen_type == "playing_now"))
+		errors.emplace_back("wrong listened_at");
+
+	std::string track_name;
+	const std::string_view track_name_key = "\"track_name\":\"";
+	if (auto i = body.find(track_name_key); i != body.npos) {
+		const auto value = body.substr(i + track_name_key.size());
+		track_name = value.substr(0, value.find('"'));
+	}
+
+	requests.push_back({listen_type, n_listens, std::move(track_name)});
+
+	return {200, "application/json", "{\"status\": \"ok\"}"};
+}
+
+ListensPoller::ListensPoller(EventLoop &_event_loop,
+			     const MockListenBrainz &_server,
+			     unsigned _target) noexcept
+	:event_loop(_event_loop), server(_server),
+	 timer(event_loop, BIND_THIS_METHOD(OnTimer)),
+	 target(_target)
+{
+	Schedule();
+}
+
+void
+ListensPoller::OnTimer() noexcept
+{
+	if (server.CountListens() >= target || --remaining == 0)
+		event_loop.Break();
+	else
+		Schedule();
+}
+
+Breaker::Breaker(EventLoop &_event_loop, Event::Duration d) noexcept
+	:event_loop(_event_loop),
+	 timer(event_loop, BIND_THIS_METHOD(OnTimer))
+{
+	timer.Schedule(d);
+}
+
+void
+Breaker::OnTimer() noexcept
+{
+	event_loop.Break();
+}
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#pragma once
+
+#include "StandInServer.hxx"
+#include "event/CoarseTimerEvent.hxx"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ScrobblerConfig;
+class EventLoop;
+
+/**
+ * A ListenBrainz server standing in for the real one in tests.  It
+ * records the requests it has accepted, and it always rejects songs
+ * titled "Poison".
+ */
+class MockListenBrainz {
+public:
+	static constexpr char TOKEN[] = "f0e1d2c3-b4a5-9687-7869-5a4b3c2d1e0f";
+
+	/**
+	 * A request accepted by the server.
+	 */
+	struct ReceivedRequest {
+		std::string listen_type;
+		unsigned n_listens;
+
+		/**
+		 * The "track_name" of the first listen.
+		 */
+		std::string track_name;
+	};
+
+private:
+	mutable std::mutex mutex;
+	std::vector<ReceivedRequest> requests;
+
+	/**
+	 * Protocol violations by the client.
+	 */
+	std::vector<std::string> errors;
+
+	/**
+	 * Declared last, so its threads are joined before the other
+	 * fields are destroyed.
+	 */
+	StandInServer server;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	MockListenBrainz();
+
+	/**
+	 * Configure a scrobbler which submits to this server.
+	 */
+	void Configure(ScrobblerConfig &config) const noexcept;
+
+	std::vector<ReceivedRequest> GetRequests() const noexcept;
+
+	/**
+	 * The number of listens accepted so far.
+	 */
+	unsigned CountListens() const noexcept;
+
+	/**
+	 * Report all protocol violations with Check().
+	 */
+	void CheckErrors() const noexcept;
+
+private:
+	StandInServer::Response HandleRequest(const StandInServer::Request &request) noexcept;
+};
+
+/**
+ * Break the #EventLoop as soon as the given number of listens has
+ * been accepted (or give up after 30 seconds).
+ */
+class ListensPoller {
+	EventLoop &event_loop;
+	const MockListenBrainz &server;
+	CoarseTimerEvent timer;
+	const unsigned target;
+	unsigned remaining = 300;
+
+public:
+	ListensPoller(EventLoop &_event_loop, const MockListenBrainz &_server,
+		      unsigned _target) noexcept;
+
+private:
+	void Schedule() noexcept {
+		timer.Schedule(std::chrono::milliseconds{100});
+	}
+
+	void OnTimer() noexcept;
+};
+
+/**
+ * Break the #EventLoop after a fixed duration.
+ */
+class Breaker {
+	EventLoop &event_loop;
+	CoarseTimerEvent timer;
+
+public:
+	Breaker(EventLoop &_event_loop, Event::Duration d) noexcept;
+
+private:
+	void OnTimer() noexcept;
+};
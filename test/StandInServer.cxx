@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "StandInServer.hxx"
+#include "system/Error.hxx"
+#include "util/CharUtil.hxx"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+StandInServer::StandInServer(Handler _handler)
+	:handler(std::move(_handler))
+{
+	listen_fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+		throw MakeErrno("Failed to create socket");
+
+	struct sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	socklen_t address_length = sizeof(address);
+	if (bind(listen_fd, (const struct sockaddr *)&address,
+		 sizeof(address)) < 0 ||
+	    listen(listen_fd, 16) < 0 ||
+	    getsockname(listen_fd, (struct sockaddr *)&address,
+			&address_length) < 0) {
+		const int e = errno;
+		close(listen_fd);
+		throw MakeErrno(e, "Failed to listen");
+	}
+
+	port = ntohs(address.sin_port);
+
+	thread = std::thread{[this]{ Run(); }};
+}
+
+StandInServer::~StandInServer() noexcept
+{
+	/* wake up the accept() call */
+	shutdown(listen_fd, SHUT_RDWR);
+	thread.join();
+	close(listen_fd);
+}
+
+std::string
+StandInServer::GetUrl(std::string_view path) const noexcept
+{
+	return fmt::format("http://127.0.0.1:{}{}", port, path);
+}
+
+void
+StandInServer::Run() noexcept
+{
+	while (true) {
+		int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+
+		/* each connection gets its own thread, so a slow
+		   request does not block the others */
+		connections.emplace_back([this, fd]{
+			HandleConnection(fd);
+			close(fd);
+		});
+	}
+
+	for (auto &i : connections)
+		i.join();
+}
+
+static std::string
+ToLower(std::string_view s) noexcept
+{
+	std::string result{s};
+	std::transform(result.begin(), result.end(), result.begin(),
+		       [](char ch){ return ToLowerASCII(ch); });
+	return result;
+}
+
+static bool
+ParseRequestHead(std::string_view head, StandInServer::Request &request) noexcept
+{
+	auto eol = head.find("\r\n");
+	const auto request_line = head.substr(0, eol);
+	head = eol == head.npos ? std::string_view{} : head.substr(eol + 2);
+
+	const auto space1 = request_line.find(' ');
+	const auto space2 = request_line.find(' ', space1 + 1);
+	if (space1 == request_line.npos || space2 == request_line.npos)
+		return false;
+
+	request.method = request_line.substr(0, space1);
+	request.path = request_line.substr(space1 + 1, space2 - space1 - 1);
+
+	while (!head.empty()) {
+		eol = head.find("\r\n");
+		const auto line = head.substr(0, eol);
+		head = eol == head.npos ? std::string_view{} : head.substr(eol + 2);
+
+		const auto colon = line.find(':');
+		if (colon == line.npos)
+			return false;
+
+		auto value = line.substr(colon + 1);
+		while (!value.empty() && value.front() == ' ')
+			value.remove_prefix(1);
+
+		request.headers.emplace(ToLower(line.substr(0, colon)),
+					value);
+	}
+
+	return true;
+}
+
+static const char *
+StatusText(unsigned status) noexcept
+{
+	switch (status) {
+	case 200: return "OK";
+	case 400: return "Bad Request";
+	case 401: return "Unauthorized";
+	case 403: return "Forbidden";
+	case 429: return "Too Many Requests";
+	case 503: return "Service Unavailable";
+	default: return "Error";
+	}
+}
+
+void
+StandInServer::HandleConnection(int fd) noexcept
+{
+	std::string buffer;
+	std::size_t head_end;
+
+	/* read the request head */
+	while ((head_end = buffer.find("\r\n\r\n")) == buffer.npos) {
+		char chunk[4096];
+		ssize_t nbytes = read(fd, chunk, sizeof(chunk));
+		if (nbytes <= 0)
+			return;
+
+		buffer.append(chunk, nbytes);
+	}
+
+	Request request;
+	if (!ParseRequestHead(std::string_view{buffer}.substr(0, head_end),
+			      request))
+		return;
+
+	buffer.erase(0, head_end + 4);
+
+	/* read the request body */
+	std::size_t content_length = 0;
+	if (auto i = request.headers.find("content-length");
+	    i != request.headers.end())
+		content_length = std::stoul(i->second);
+
+	while (buffer.size() < content_length) {
+		char chunk[4096];
+		ssize_t nbytes = read(fd, chunk, sizeof(chunk));
+		if (nbytes <= 0)
+			return;
+
+		buffer.append(chunk, nbytes);
+	}
+
+	request.body = std::move(buffer);
+
+	const auto response = handler(request);
+
+	const auto head = fmt::format("HTTP/1.1 {} {}\r\n"
+				      "Content-Type: {}\r\n"
+				      "Content-Length: {}\r\n"
+				      "Connection: close\r\n"
+				      "\r\n",
+				      response.status,
+				      StatusText(response.status),
+				      response.content_type,
+				      response.body.size());
+
+	const auto send_all = [fd](std::string_view s){
+		while (!s.empty()) {
+			ssize_t nbytes = write(fd, s.data(), s.size());
+			if (nbytes <= 0)
+				return;
+			s.remove_prefix(nbytes);
+		}
+	};
+
+	send_all(head);
+	send_all(response.body);
+}
+
+static std::string
+UrlDecode(std::string_view s) noexcept
+{
+	std::string result;
+	result.reserve(s.size());
+
+	for (std::size_t i = 0; i < s.size(); ++i) {
+		if (s[i] == '+')
+			result.push_back(' ');
+		else if (s[i] == '%' && i + 2 < s.size() &&
+			 IsHexDigit(s[i + 1]) && IsHexDigit(s[i + 2])) {
+			result.push_back((char)std::stoi(std::string{s.substr(i + 1, 2)},
+							 nullptr, 16));
+			i += 2;
+		} else
+			result.push_back(s[i]);
+	}
+
+	return result;
+}
+
+std::multimap<std::string, std::string, std::less<>>
+ParseFormData(std::string_view body) noexcept
+{
+	std::multimap<std::string, std::string, std::less<>> result;
+
+	while (!body.empty()) {
+		const auto amp = body.find('&');
+		const auto pair = body.substr(0, amp);
+		body = amp == body.npos ? std::string_view{} : body.substr(amp + 1);
+
+		const auto eq = pair.find('=');
+		if (eq == pair.npos)
+			result.emplace(UrlDecode(pair), std::string{});
+		else
+			result.emplace(UrlDecode(pair.substr(0, eq)),
+				       UrlDecode(pair.substr(eq + 1)));
+	}
+
+	return result;
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/**
+ * A minimal HTTP/1.1 server running in a separate thread, standing
+ * in for a scrobbler web service in tests.  It handles one request
+ * per connection, and each connection in a separate thread.
+ */
+class StandInServer {
+public:
+	struct Request {
+		std::string method, path;
+
+		/**
+		 * Header names are converted to lower case.
+		 */
+		std::map<std::string, std::string, std::less<>> headers;
+
+		std::string body;
+	};
+
+	struct Response {
+		unsigned status = 200;
+		std::string content_type = "text/plain";
+		std::string body;
+	};
+
+	/**
+	 * Invoked in the server thread for each request.
+	 */
+	using Handler = std::function<Response(const Request &request)>;
+
+private:
+	const Handler handler;
+
+	int listen_fd;
+	unsigned port;
+
+	std::thread thread;
+
+	/**
+	 * The threads handling connections; they are owned by
+	 * #thread.
+	 */
+	std::vector<std::thread> connections;
+
+public:
+	/**
+	 * Listen on a random port on the loopback interface.
+	 *
+	 * Throws on error.
+	 */
+	explicit StandInServer(Handler _handler);
+	~StandInServer() noexcept;
+
+	StandInServer(const StandInServer &) = delete;
+	StandInServer &operator=(const StandInServer &) = delete;
+
+	std::string GetUrl(std::string_view path) const noexcept;
+
+private:
+	void Run() noexcept;
+	void HandleConnection(int fd) noexcept;
+};
+
+/**
+ * Decode an "application/x-www-form-urlencoded" request body.
+ */
+std::multimap<std::string, std::string, std::less<>>
+ParseFormData(std::string_view body) noexcept;
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Unit tests for the circuit breaker in class HostHealth.
+ */
+
+#include "HostHealth.hxx"
+#include "TestUtil.hxx"
+
+using std::chrono::seconds;
+using std::chrono::minutes;
+
+struct CountingListener final : HostHealthListener {
+	unsigned n_recovered = 0, n_released = 0;
+
+	void OnHostRecovered() noexcept override {
+		++n_recovered;
+	}
+
+	void OnProbeReleased() noexcept override {
+		++n_released;
+	}
+};
+
+static void
+TestKey() noexcept
+{
+	Check(HostHealth::GetKey("https://ws.audioscrobbler.com/2.0/") ==
+	      "https://ws.audioscrobbler.com", "key with path");
+	Check(HostHealth::GetKey("http://127.0.0.1:8080") ==
+	      "http://127.0.0.1:8080", "key without path");
+}
+
+static void
+TestJitter() noexcept
+{
+	for (unsigned i = 0; i < 100; ++i) {
+		const auto d = HostHealth::Jitter(minutes{1});
+		Check(d >= seconds{30} && d <= minutes{1}, "jitter range");
+	}
+
+	Check(HostHealth::Jitter(Event::Duration::zero()) == Event::Duration::zero(),
+	      "no jitter for zero");
+}
+
+static void
+TestCircuitBreaker() noexcept
+{
+	HostHealth health{"test"};
+	CountingListener a, b;
+	health.AddListener(a);
+	health.AddListener(b);
+
+	auto now = Event::TimePoint{} + minutes{1000};
+
+	/* below the threshold, requests are still allowed */
+	health.OnFailure(now, {});
+	health.OnFailure(now, {});
+	Check(health.Acquire(now), "closed below threshold");
+	Check(health.GetDelay(now) == Event::Duration::zero(), "no delay");
+
+	health.OnFailure(now, {});
+	Check(!health.Acquire(now), "open after threshold");
+
+	const auto delay = health.GetDelay(now);
+	Check(delay >= seconds{30} && delay <= minutes{2}, "first backoff");
+
+	/* after the backoff, exactly one probe is allowed */
+	now += minutes{2};
+	Check(health.Acquire(now), "probe");
+	Check(!health.Acquire(now), "only one probe");
+
+	/* a failed probe doubles the backoff */
+	health.OnFailure(now, {});
+	Check(!health.Acquire(now + seconds{59}), "open after failed probe");
+	Check(health.GetDelay(now) >= minutes{1}, "second backoff");
+
+	now += minutes{4};
+	Check(health.Acquire(now), "second probe");
+
+	/* a lost probe is replaced after a while */
+	Check(!health.Acquire(now + seconds{10}), "probe in flight");
+	Check(health.Acquire(now + minutes{3}), "lost probe replaced");
+
+	health.OnSuccess();
+	Check(a.n_recovered == 1 && b.n_recovered == 1, "listeners notified");
+	Check(health.Acquire(now), "closed after success");
+
+	/* no notification if the circuit was not open */
+	health.OnSuccess();
+	Check(a.n_recovered == 1, "no spurious notification");
+
+	health.RemoveListener(a);
+	health.RemoveListener(b);
+}
+
+static void
+TestRelease() noexcept
+{
+	HostHealth health{"test"};
+	CountingListener a;
+	health.AddListener(a);
+
+	auto now = Event::TimePoint{} + minutes{1000};
+
+	/* releasing is a no-op unless probing */
+	health.Release(now);
+	Check(a.n_released == 0, "no release while closed");
+
+	health.OnFailure(now, minutes{1});
+	now += minutes{1};
+	Check(health.Acquire(now), "probe");
+	Check(health.IsProbing(), "probing");
+
+	/* the probe was not sent: another caller may send it right
+	   away */
+	health.Release(now);
+	Check(a.n_released == 1, "listener notified of release");
+	Check(!health.IsProbing(), "not probing after release");
+	Check(health.GetDelay(now) == Event::Duration::zero(),
+	      "no delay after release");
+	Check(health.Acquire(now), "probe after release");
+	Check(!health.Acquire(now), "only one probe after release");
+
+	/* the backoff did not grow */
+	health.OnFailure(now, {});
+	Check(health.GetDelay(now) <= minutes{4}, "release does not count as failure");
+
+	health.RemoveListener(a);
+}
+
+static void
+TestRetryAfter() noexcept
+{
+	HostHealth health{"test"};
+
+	const auto now = Event::TimePoint{} + minutes{1000};
+
+	/* the server's hint opens the circuit immediately */
+	health.OnFailure(now, minutes{5});
+	Check(!health.Acquire(now + minutes{4}), "Retry-After respected");
+	Check(health.GetDelay(now) >= minutes{5}, "Retry-After delay");
+	Check(health.Acquire(now + minutes{5}), "probe after Retry-After");
+}
+
+int
+main() noexcept
+{
+	TestKey();
+	TestJitter();
+	TestCircuitBreaker();
+	TestRelease();
+	TestRetryAfter();
+
+	return TestExitStatus();
+}
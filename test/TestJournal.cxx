@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Unit tests for class Journal, class SharedJournal and the lazy
+ * loading of their records (class JournalBacklog).
+ */
+
+#include "Journal.hxx"
+#include "SharedJournal.hxx"
+#include "TestUtil.hxx"
+#include "event/Loop.hxx"
+#include "system/Error.hxx"
+#include "util/PrintException.hxx"
+
+#include <fmt/core.h>
+
+#include <string>
+#include <thread>
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Decode all records of the backlog and check that they are the
+ * consecutive tracks beginning with the given one.
+ */
+static void
+CheckTracks(const RecordQueue &queue, unsigned first,
+	    const char *what) noexcept
+{
+	unsigned i = first;
+	for (const auto &record : queue) {
+		Check(record->GetTrack() == fmt::format("Track {}", i) &&
+		      record->GetTimestamp() == 1700000000 + i * 200 &&
+		      record->IsLoved() == (i % 2 == 0),
+		      what);
+		++i;
+	}
+}
+
+static off_t
+GetFileSize(const std::string &path) noexcept
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+static void
+TestFormat(const char *directory, JournalFormat format)
+{
+	EventLoop event_loop;
+	const std::string path = fmt::format("{}/journal", directory);
+
+	{
+		Journal journal{event_loop, path, format};
+		for (unsigned i = 0; i < 10; ++i)
+			journal.Append(*MakeRecord(i));
+		journal.Acknowledge(3);
+		for (unsigned i = 10; i < 12; ++i)
+			journal.Append(*MakeRecord(i));
+	}
+
+	Journal journal{event_loop, path, format};
+	auto backlog = journal.Read();
+	Check(backlog.size() == 9, "number of indexed records");
+	Check(!journal.NeedsCompaction(), "no compaction needed");
+
+	/* only the head is decoded */
+	RecordQueue queue;
+	Check(backlog.Pop(queue, 4) == 4, "decoded head");
+	Check(backlog.size() == 5, "remaining backlog");
+	CheckTracks(queue, 3, "head contents");
+
+	/* compacting replaces the file while the backlog still
+	   refers to the old one */
+	Check(journal.Compact(queue, &backlog, nullptr), "compact");
+
+	/* these entries are written while the compaction may still
+	   be running; they must not get lost */
+	journal.Append(*MakeRecord(12));
+	journal.Acknowledge(1);
+
+	RecordQueue rest;
+	Check(backlog.Pop(rest, 100) == 5, "decoded rest");
+	Check(backlog.empty(), "backlog drained");
+	CheckTracks(rest, 7, "rest contents");
+
+	/* the new file contains the entries written in the meantime
+	   as soon as it replaces the old one (nothing is called here
+	   which could append them later) */
+	const off_t uncompacted_size = GetFileSize(path);
+	for (unsigned i = 0; i < 500 && GetFileSize(path) >= uncompacted_size; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds{10});
+
+	{
+		auto b = Journal{event_loop, path, format}.Read();
+		RecordQueue q;
+		b.Pop(q, 1);
+		Check(b.size() == 8 && q.size() == 1 &&
+		      q.front()->GetTrack() == "Track 4",
+		      "tail in the new file");
+	}
+
+	journal.WaitCompaction();
+	Check(access(fmt::format("{}.tmp", path).c_str(), F_OK) != 0,
+	      "temporary file removed");
+
+	Journal compacted{event_loop, path, format};
+	auto backlog2 = compacted.Read();
+	Check(backlog2.size() == 9, "number of compacted records");
+
+	RecordQueue all;
+	backlog2.ForEach([&all](const Record &record){
+		all.emplace_back(std::make_shared<const Record>(record.GetArtist(),
+								record.GetTrack(),
+								record.GetAlbum(),
+								record.GetNumber(),
+								record.GetMbid(),
+								std::chrono::sys_seconds{std::chrono::seconds{record.GetTimestamp()}},
+								record.GetLength(),
+								record.IsLoved(),
+								record.IsRadio()));
+	});
+	Check(all.size() == 9, "ForEach() visits all records");
+	CheckTracks(all, 4, "compacted contents");
+
+	unlink(path.c_str());
+}
+
+/**
+ * Load the backlog of the given cursor and check that it contains
+ * the consecutive tracks from #first to #last.
+ */
+static void
+CheckCursor(ScrobblerJournal &cursor, unsigned first, unsigned last,
+	    const char *what) noexcept
+{
+	auto backlog = cursor.Read();
+	Check(backlog.size() == last + 1 - first, what);
+
+	RecordQueue queue;
+	backlog.Pop(queue, backlog.size());
+	CheckTracks(queue, first, what);
+}
+
+static void
+TestShared(const char *directory)
+{
+	EventLoop event_loop;
+	const std::string path = fmt::format("{}/shared", directory);
+
+	{
+		SharedJournal shared{event_loop, path};
+		auto a = shared.Open("a", nullptr);
+		auto b = shared.Open("b", nullptr);
+		shared.FinishOpen();
+
+		Check(a->Read().empty() && b->Read().empty(),
+		      "new shared journal is empty");
+
+		/* both scrobblers append the same record object */
+		for (unsigned i = 0; i < 10; ++i) {
+			const auto record = MakeRecord(i);
+			a->Append(*record);
+			b->Append(*record);
+		}
+
+		a->Acknowledge(4);
+		b->Acknowledge(2);
+
+		/* reload while in use (after FinishOpen() has
+		   released the file loaded at startup) */
+		CheckCursor(*a, 4, 9, "cursor a reloaded");
+	}
+
+	const off_t uncompacted_size = GetFileSize(path);
+
+	{
+		SharedJournal shared{event_loop, path};
+		auto a = shared.Open("a", nullptr);
+		auto b = shared.Open("b", nullptr);
+
+		/* each record is stored only once, so there are no
+		   duplicates */
+		CheckCursor(*a, 4, 9, "cursor a");
+		CheckCursor(*b, 2, 9, "cursor b");
+
+		/* a new scrobbler starts with the next record */
+		auto c = shared.Open("c", nullptr);
+		Check(c->Read().empty(), "new cursor is empty");
+		shared.FinishOpen();
+
+		b->Acknowledge(4);
+		Check(a->NeedsCompaction(true), "shared compaction needed");
+		Check(b->Compact({}, nullptr, nullptr), "shared compact");
+
+		/* appended while the compaction may be running */
+		const auto record = MakeRecord(10);
+		a->Append(*record);
+		b->Append(*record);
+		c->Append(*record);
+
+		/* this waits for the compaction to finish */
+		CheckCursor(*c, 10, 10, "cursor c reloaded");
+	}
+
+	Check(GetFileSize(path) < uncompacted_size,
+	      "compaction drops records");
+
+	{
+		SharedJournal shared{event_loop, path};
+		auto a = shared.Open("a", nullptr);
+		auto b = shared.Open("b", nullptr);
+		auto c = shared.Open("c", nullptr);
+
+		CheckCursor(*a, 4, 10, "compacted cursor a");
+		CheckCursor(*b, 6, 10, "compacted cursor b");
+		CheckCursor(*c, 10, 10, "compacted cursor c");
+	}
+	unlink(path.c_str());
+}
+
+static void
+TestMissing(const char *directory)
+{
+	EventLoop event_loop;
+	const std::string path = fmt::format("{}/missing", directory);
+
+	Journal journal{event_loop, path, JournalFormat::TEXT};
+	Check(journal.Read().empty(), "missing journal is empty");
+}
+
+int
+main() noexcept
+try {
+	char directory[] = "/tmp/TestJournal.XXXXXX";
+	if (mkdtemp(directory) == nullptr)
+		throw MakeErrno("mkdtemp() failed");
+
+	TestFormat(directory, JournalFormat::TEXT);
+	TestFormat(directory, JournalFormat::BINARY);
+	TestShared(directory);
+	TestMissing(directory);
+
+	rmdir(directory);
+
+	return TestExitStatus();
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
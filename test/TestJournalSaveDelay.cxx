@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Verify that with "journal_save_delay", the journal is compacted
+ * soon after songs have been submitted, not only after many of them.
+ */
+
+#include "MockListenBrainz.hxx"
+#include "TestUtil.hxx"
+#include "Scrobbler.hxx"
+#include "ScrobblerConfig.hxx"
+#include "lib/curl/Global.hxx"
+#include "lib/curl/Init.hxx"
+#include "event/Loop.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "system/Error.hxx"
+#include "util/PrintException.hxx"
+
+#include <fmt/core.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Read the whole (small) file into a string.
+ */
+static std::string
+ReadFile(const char *path) noexcept
+{
+	std::string contents;
+
+	FILE *file = fopen(path, "r");
+	if (file == nullptr)
+		return contents;
+
+	char buffer[4096];
+	std::size_t nbytes;
+	while ((nbytes = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		contents.append(buffer, nbytes);
+
+	fclose(file);
+	return contents;
+}
+
+/**
+ * Break the #EventLoop as soon as the journal file has been
+ * compacted after all songs were submitted.
+ */
+class CompactionPoller {
+	EventLoop &event_loop;
+	const MockListenBrainz &server;
+	CoarseTimerEvent timer;
+	const std::string &path;
+	const unsigned target;
+	unsigned remaining = 100;
+
+public:
+	CompactionPoller(EventLoop &_event_loop, const MockListenBrainz &_server,
+			 const std::string &_path, unsigned _target) noexcept
+		:event_loop(_event_loop), server(_server),
+		 timer(event_loop, BIND_THIS_METHOD(OnTimer)),
+		 path(_path), target(_target) {
+		Schedule();
+	}
+
+private:
+	void Schedule() noexcept {
+		timer.Schedule(std::chrono::milliseconds{100});
+	}
+
+	void OnTimer() noexcept {
+		if ((server.CountListens() >= target &&
+		     ReadFile(path.c_str()).empty()) ||
+		    --remaining == 0)
+			event_loop.Break();
+		else
+			Schedule();
+	}
+};
+
+static void
+TestJournalSaveDelay()
+{
+	char directory[] = "/tmp/TestJournalSaveDelay.XXXXXX";
+	if (mkdtemp(directory) == nullptr)
+		throw MakeErrno("mkdtemp() failed");
+
+	const std::string journal = fmt::format("{}/journal", directory);
+
+	MockListenBrainz server;
+
+	EventLoop event_loop;
+	const ScopeCurlInit curl_init;
+	CurlGlobal curl_global{event_loop, nullptr};
+
+	ScrobblerConfig config;
+	server.Configure(config);
+	config.journal = journal;
+	config.journal_save_delay = std::chrono::seconds{1};
+
+	const auto start = std::chrono::steady_clock::now();
+
+	{
+		Scrobbler scrobbler{config, event_loop, curl_global};
+
+		for (unsigned i = 0; i < 3; ++i)
+			scrobbler.Push(MakeRecord(i));
+
+		CompactionPoller poller{event_loop, server, journal, 3};
+		event_loop.Run();
+	}
+
+	Check(std::chrono::steady_clock::now() - start < std::chrono::seconds{8},
+	      "journal compacted soon");
+	Check(ReadFile(journal.c_str()).empty(), "journal is empty");
+
+	unlink(journal.c_str());
+	rmdir(directory);
+}
+
+int
+main() noexcept
+try {
+	TestJournalSaveDelay();
+
+	return TestExitStatus();
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
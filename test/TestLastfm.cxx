@@ -0,0 +1,338 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Submit songs with the Last.fm 2.0 protocol to a local stand-in
+ * server and verify the requests.
+ */
+
+#include "StandInServer.hxx"
+#include "TestUtil.hxx"
+#include "Scrobbler.hxx"
+#include "ScrobblerConfig.hxx"
+#include "Lastfm.hxx"
+#include "Protocol.hxx"
+#include "lib/curl/Global.hxx"
+#include "lib/curl/Init.hxx"
+#include "event/Loop.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "system/Error.hxx"
+#include "util/PrintException.hxx"
+
+#include <fmt/core.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char API_KEY[] = "0123456789abcdef0123456789abcdef";
+static constexpr char API_SECRET[] = "fedcba9876543210fedcba9876543210";
+static constexpr char SESSION_KEY[] = "d580d57f32848f5dcf574d1ce18d78b2";
+static constexpr unsigned N_SONGS = 120;
+
+/**
+ * A "track.updateNowPlaying" call signed with a well-known result
+ * (calculated independently).
+ */
+static void
+TestSignature() noexcept
+{
+	Lastfm::Call call("track.updateNowPlaying", "KEY");
+	call.Add("sk", "SK");
+	call.Add("track", "T");
+	call.Add("artist", "A & B");
+	call.Add("album", "");
+
+	const auto body = std::move(call).Finish("SECRET");
+	Check(body == "api_key=KEY&artist=A%20%26%20B&method=track.updateNowPlaying&sk=SK&track=T&api_sig=b03103732c54a272284bf592cadab4ee",
+	      "signature");
+}
+
+static void
+TestParser() noexcept
+{
+	auto r = Lastfm::ParseResponse("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+				       "<lfm status=\"ok\">\n"
+				       "<session><name>u</name><key>k</key></session></lfm>");
+	Check(r.ok, "ok response");
+
+	r = Lastfm::ParseResponse("<lfm status=\"failed\"><error code=\"9\">Invalid session key</error></lfm>");
+	Check(!r.ok && r.error == Lastfm::INVALID_SESSION_KEY &&
+	      r.message == "Invalid session key",
+	      "error response");
+
+	r = Lastfm::ParseResponse("<html>Bad Gateway</html>");
+	Check(!r.ok && r.error == 0, "malformed response");
+
+	Check(Lastfm::FindAttribute("<scrobbles accepted=\"2\" ignored=\"1\">",
+				    "scrobbles", "ignored") == "1",
+	      "attribute");
+}
+
+/**
+ * The state of the stand-in server, protected by #mutex.
+ */
+static struct {
+	std::mutex mutex;
+	unsigned sessions = 0;
+	bool rejected_session = false;
+	std::vector<unsigned> batches;
+	std::vector<std::string> errors;
+} server_state;
+
+static std::atomic_uint n_accepted;
+
+/**
+ * Verify the "api_sig" parameter of a request.
+ */
+static bool
+CheckSignature(const std::multimap<std::string, std::string, std::less<>> &params) noexcept
+{
+	std::string input, api_sig;
+	for (const auto &[name, value] : params) {
+		if (name == "api_sig") {
+			api_sig = value;
+			continue;
+		}
+
+		input += name;
+		input += value;
+	}
+
+	input += API_SECRET;
+	return api_sig == std::string_view{md5_hex(input)};
+}
+
+static StandInServer::Response
+Error(unsigned status, unsigned code, std::string_view message) noexcept
+{
+	return {
+		status, "text/xml",
+		fmt::format("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+			    "<lfm status=\"failed\">\n"
+			    "<error code=\"{}\">{}</error></lfm>\n",
+			    code, message),
+	};
+}
+
+static StandInServer::Response
+HandleRequest(const StandInServer::Request &request) noexcept
+{
+	const std::scoped_lock lock{server_state.mutex};
+
+	const auto params = ParseFormData(request.body);
+	const auto Get = [&params](std::string_view name) -> std::string {
+		auto i = params.find(name);
+		return i != params.end() ? i->second : std::string{};
+	};
+
+	if (request.method != "POST" || request.path != "/2.0/") {
+		server_state.errors.emplace_back("wrong request line");
+		return Error(400, 6, "Invalid parameters");
+	}
+
+	if (Get("api_key") != API_KEY || !CheckSignature(params)) {
+		server_state.errors.emplace_back("bad signature");
+		return Error(403, 13, "Invalid method signature supplied");
+	}
+
+	const auto method = Get("method");
+	if (method == "auth.getMobileSession") {
+		if (Get("username") != "user" || Get("password") != "secret")
+			return Error(403, 4, "Authentication Failed");
+
+		++server_state.sessions;
+		return {
+			200, "text/xml",
+			fmt::format("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+				    "<lfm status=\"ok\">\n"
+				    "<session><name>user</name><key>{}</key>"
+				    "<subscriber>0</subscriber></session></lfm>\n",
+				    SESSION_KEY),
+		};
+	} else if (method == "track.scrobble") {
+		if (!server_state.rejected_session) {
+			/* reject the first submission to test
+			   obtaining a new session key */
+			server_state.rejected_session = true;
+			return Error(403, Lastfm::INVALID_SESSION_KEY,
+				     "Invalid session key - Please re-authenticate");
+		}
+
+		if (Get("sk") != SESSION_KEY)
+			return Error(403, Lastfm::INVALID_SESSION_KEY,
+				     "Invalid session key - Please re-authenticate");
+
+		unsigned n = 0;
+		while (params.contains(fmt::format("artist[{}]", n))) {
+			if (Get(fmt::format("artist[{}]", n)) != "Motörhead & Friends" ||
+			    Get(fmt::format("track[{}]", n)) != fmt::format("Track {}", n_accepted + n) ||
+			    Get(fmt::format("timestamp[{}]", n)).empty())
+				server_state.errors.emplace_back("wrong track data");
+			++n;
+		}
+
+		server_state.batches.push_back(n);
+		n_accepted += n;
+
+		return {
+			200, "text/xml",
+			fmt::format("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+				    "<lfm status=\"ok\">\n"
+				    "<scrobbles accepted=\"{}\" ignored=\"0\">"
+				    "</scrobbles></lfm>\n", n),
+		};
+	} else {
+		server_state.errors.emplace_back(fmt::format("unexpected method {:?}", method));
+		return Error(400, 3, "Invalid Method");
+	}
+}
+
+/**
+ * Break the #EventLoop as soon as the server has accepted the given
+ * number of songs (or give up after a while).
+ */
+class Poller {
+	EventLoop &event_loop;
+	CoarseTimerEvent timer;
+	const unsigned target;
+	unsigned remaining = 300;
+
+public:
+	Poller(EventLoop &_event_loop, unsigned _target) noexcept
+		:event_loop(_event_loop),
+		 timer(event_loop, BIND_THIS_METHOD(OnTimer)),
+		 target(_target) {}
+
+	void Schedule() noexcept {
+		timer.Schedule(std::chrono::milliseconds{100});
+	}
+
+private:
+	void OnTimer() noexcept {
+		if (n_accepted >= target || --remaining == 0)
+			event_loop.Break();
+		else
+			Schedule();
+	}
+};
+
+static ScrobblerConfig
+MakeConfig(const StandInServer &server) noexcept
+{
+	ScrobblerConfig config;
+	config.name = "test";
+	config.protocol = ScrobblerProtocol::LASTFM;
+	config.url = server.GetUrl("/2.0/");
+	config.username = "user";
+	config.password = "secret";
+	config.api_key = API_KEY;
+	config.api_secret = API_SECRET;
+	config.max_batch = Lastfm::MAX_SCROBBLES;
+	config.ignore_list = nullptr;
+	return config;
+}
+
+/**
+ * Start a new #Scrobbler, push songs to it and run the #EventLoop
+ * until the server has accepted all of them.
+ */
+static void
+Submit(const ScrobblerConfig &config, unsigned n)
+{
+	EventLoop event_loop;
+	const ScopeCurlInit curl_init;
+	CurlGlobal curl_global{event_loop, nullptr};
+
+	Scrobbler scrobbler{config, event_loop, curl_global};
+
+	const unsigned first = n_accepted;
+	const auto now = std::chrono::time_point_cast<std::chrono::seconds>(std::chrono::system_clock::now());
+	for (unsigned i = 0; i < n; ++i)
+		scrobbler.Push(MakeRecord(first + i, "Motörhead & Friends",
+					  now - std::chrono::seconds{200 * (first + n)}));
+
+	Poller poller{event_loop, first + n};
+	poller.Schedule();
+
+	event_loop.Run();
+}
+
+static void
+TestSubmit()
+{
+	StandInServer server{HandleRequest};
+	Submit(MakeConfig(server), N_SONGS);
+
+	const std::scoped_lock lock{server_state.mutex};
+	for (const auto &i : server_state.errors)
+		Check(false, i.c_str());
+
+	Check(n_accepted == N_SONGS, "all songs accepted");
+	Check(server_state.sessions == 2, "re-authenticated once");
+	Check(server_state.batches == std::vector<unsigned>{50, 50, 20},
+	      "batch sizes");
+}
+
+/**
+ * A restarted scrobbler reuses the session saved next to the
+ * journal.
+ */
+static void
+TestSessionReuse()
+{
+	char directory[] = "/tmp/TestLastfm.XXXXXX";
+	if (mkdtemp(directory) == nullptr)
+		throw MakeErrno("mkdtemp() failed");
+
+	const std::string journal = fmt::format("{}/journal", directory);
+	const std::string session_file = journal + ".session";
+
+	StandInServer server{HandleRequest};
+
+	auto config = MakeConfig(server);
+	config.journal = journal;
+
+	{
+		const std::scoped_lock lock{server_state.mutex};
+		server_state.sessions = 0;
+	}
+
+	Submit(config, 3);
+
+	struct stat st;
+	Check(stat(session_file.c_str(), &st) == 0 &&
+	      (st.st_mode & 0777) == 0600,
+	      "session file permissions");
+
+	Submit(config, 3);
+
+	const std::scoped_lock lock{server_state.mutex};
+	for (const auto &i : server_state.errors)
+		Check(false, i.c_str());
+
+	Check(server_state.sessions == 1, "session reused");
+	Check(n_accepted == N_SONGS + 6, "songs accepted after restart");
+
+	unlink(session_file.c_str());
+	unlink(journal.c_str());
+	rmdir(directory);
+}
+
+int
+main() noexcept
+try {
+	TestSignature();
+	TestParser();
+	TestSubmit();
+	TestSessionReuse();
+
+	return TestExitStatus();
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Submit songs with the ListenBrainz protocol to a local mock server
+ * and verify the requests.
+ */
+
+#include "MockListenBrainz.hxx"
+#include "TestUtil.hxx"
+#include "Scrobbler.hxx"
+#include "ScrobblerConfig.hxx"
+#include "ListenBrainz.hxx"
+#include "lib/curl/Global.hxx"
+#include "lib/curl/Init.hxx"
+#include "event/Loop.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "util/PrintException.hxx"
+#include "config.h"
+
+#include <fmt/core.h>
+
+#include <stdlib.h>
+
+static constexpr unsigned N_BACKLOG = 1205;
+
+static void
+TestSubmission() noexcept
+{
+	ListenBrainz::Submission submission{"single"};
+	submission.Add(*MakeRecord(0));
+	const auto json = std::move(submission).Finish();
+
+	Check(json == "{\"listen_type\":\"single\",\"payload\":[{"
+	      "\"listened_at\":1700000000,"
+	      "\"track_metadata\":{\"artist_name\":\"Artist \\\"Quoted\\\"\","
+	      "\"track_name\":\"Track 0\","
+	      "\"release_name\":\"Album\\\\Path\","
+	      "\"additional_info\":{\"submission_client\":\"mpdscribble\","
+	      "\"submission_client_version\":\"" VERSION "\","
+	      "\"duration\":180,\"tracknumber\":\"7\","
+	      "\"recording_mbid\":\"b1a9c0e9-d987-4042-ae91-78d6a3267d69\"}}}]}",
+	      "JSON encoding");
+
+	Check(ListenBrainz::FindErrorMessage("{\"code\": 401, \"error\": \"Invalid \\\"token\\\"\"}") == "Invalid \\\"token\\\"",
+	      "error message");
+
+	Check(ListenBrainz::MakeSubmitUrl("http://localhost:8100") ==
+	      "http://localhost:8100/1/submit-listens",
+	      "submit URL");
+}
+
+/**
+ * Drive the test from the #EventLoop: poll the mock server state
+ * and push a new song after the backlog has been submitted.
+ */
+class Poller {
+	EventLoop &event_loop;
+	const MockListenBrainz &server;
+	Scrobbler &scrobbler;
+	CoarseTimerEvent timer;
+	unsigned remaining = 300;
+	bool pushed = false;
+
+public:
+	Poller(EventLoop &_event_loop, const MockListenBrainz &_server,
+	       Scrobbler &_scrobbler) noexcept
+		:event_loop(_event_loop), server(_server), scrobbler(_scrobbler),
+		 timer(event_loop, BIND_THIS_METHOD(OnTimer)) {}
+
+	void Schedule() noexcept {
+		timer.Schedule(std::chrono::milliseconds{100});
+	}
+
+private:
+	void OnTimer() noexcept {
+		const std::size_t n_requests = server.GetRequests().size();
+
+		if (n_requests >= 3 && !pushed) {
+			/* the backlog and the "now playing" song
+			   have been submitted; now play a song in
+			   real time */
+			pushed = true;
+			scrobbler.Push(MakeRecord(N_BACKLOG));
+		}
+
+		if (n_requests >= 4 || --remaining == 0)
+			event_loop.Break();
+		else
+			Schedule();
+	}
+};
+
+static void
+TestSubmit()
+{
+	MockListenBrainz server;
+
+	EventLoop event_loop;
+	const ScopeCurlInit curl_init;
+	CurlGlobal curl_global{event_loop, nullptr};
+
+	ScrobblerConfig config;
+	server.Configure(config);
+	config.max_batch = ListenBrainz::MAX_LISTENS;
+
+	Scrobbler scrobbler{config, event_loop, curl_global};
+
+	for (unsigned i = 0; i < N_BACKLOG; ++i)
+		scrobbler.Push(MakeRecord(i));
+
+	scrobbler.ScheduleNowPlaying(MakeRecord(N_BACKLOG));
+
+	Poller poller{event_loop, server, scrobbler};
+	poller.Schedule();
+
+	event_loop.Run();
+
+	server.CheckErrors();
+
+	const auto r = server.GetRequests();
+	Check(r.size() == 4, "number of requests");
+	if (r.size() != 4)
+		return;
+
+	Check(r[0].listen_type == "playing_now" && r[0].n_listens == 1,
+	      "playing_now before the backlog");
+	Check(r[1].listen_type == "import" && r[1].n_listens == 1000,
+	      "first import");
+	Check(r[2].listen_type == "import" && r[2].n_listens == 205,
+	      "second import");
+	Check(r[3].listen_type == "single" && r[3].n_listens == 1,
+	      "single");
+}
+
+int
+main() noexcept
+try {
+	TestSubmission();
+	TestSubmit();
+	return TestExitStatus();
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Verify that skipping through songs quickly sends only one "now
+ * playing" notification, that a route does not cancel the
+ * notification of another route, and that canceling a notification
+ * does not keep the circuit breaker's probe.
+ */
+
+#include "MockListenBrainz.hxx"
+#include "TestUtil.hxx"
+#include "MultiScrobbler.hxx"
+#include "Scrobbler.hxx"
+#include "HostHealth.hxx"
+#include "ScrobblerRoute.hxx"
+#include "ScrobblerConfig.hxx"
+#include "IgnoreList.hxx"
+#include "ListenBrainz.hxx"
+#include "lib/curl/Global.hxx"
+#include "lib/curl/Init.hxx"
+#include "event/Loop.hxx"
+#include "util/PrintException.hxx"
+
+#include <fmt/core.h>
+
+#include <forward_list>
+#include <memory>
+
+static void
+TestNowPlayingDelay()
+{
+	MockListenBrainz server;
+
+	EventLoop event_loop;
+	const ScopeCurlInit curl_init;
+	CurlGlobal curl_global{event_loop, nullptr};
+
+	std::forward_list<ScrobblerConfig> configs;
+	auto &config = configs.emplace_front();
+	server.Configure(config);
+	config.max_batch = ListenBrainz::MAX_LISTENS;
+
+	MultiScrobbler scrobblers{configs, event_loop, curl_global};
+	ScrobblerRoute route{event_loop, scrobblers.Select({}),
+			     std::chrono::milliseconds{500}};
+
+	for (unsigned i = 0; i < 5; ++i)
+		route.NowPlaying("Artist", fmt::format("Skipped {}", i).c_str(),
+				 "Album", "1", nullptr,
+				 std::chrono::minutes{3});
+
+	Breaker breaker{event_loop, std::chrono::seconds{3}};
+	event_loop.Run();
+
+	Check(route.GetSuppressedNowPlaying() == 4,
+	      "suppressed 'now playing' count");
+
+	server.CheckErrors();
+
+	const auto r = server.GetRequests();
+	Check(r.size() == 1 && r.front().listen_type == "playing_now" &&
+	      r.front().track_name == "Skipped 4",
+	      "only the last song is announced");
+}
+
+static void
+TestSharedScrobbler()
+{
+	MockListenBrainz server;
+
+	EventLoop event_loop;
+	const ScopeCurlInit curl_init;
+	CurlGlobal curl_global{event_loop, nullptr};
+
+	/* the songs of the second MPD are not announced */
+	IgnoreList ignore_list;
+	ignore_list.entries.push_back({.artist = "Radio"});
+
+	std::forward_list<ScrobblerConfig> configs;
+	auto &config = configs.emplace_front();
+	server.Configure(config);
+	config.ignore_list = &ignore_list;
+
+	MultiScrobbler scrobblers{configs, event_loop, curl_global};
+	ScrobblerRoute a{event_loop, scrobblers.Select({}),
+			 Event::Duration::zero()};
+	ScrobblerRoute b{event_loop, scrobblers.Select({}),
+			 std::chrono::milliseconds{100}};
+
+	a.NowPlaying("Artist", "Song A", "Album", "1", nullptr,
+		     std::chrono::minutes{3});
+
+	/* a song change on the second MPD must not discard the
+	   first one's notification */
+	b.NowPlaying("Radio", "Song B", "Album", "1", nullptr,
+		     std::chrono::minutes{3});
+
+	Breaker breaker{event_loop, std::chrono::seconds{3}};
+	event_loop.Run();
+
+	Check(b.GetSuppressedNowPlaying() == 0,
+	      "nothing suppressed by the second route");
+
+	server.CheckErrors();
+
+	const auto r = server.GetRequests();
+	Check(r.size() == 1 && r.front().listen_type == "playing_now" &&
+	      r.front().track_name == "Song A",
+	      "the first route's song is announced");
+}
+
+static void
+TestDiscardReleasesProbe()
+{
+	MockListenBrainz server;
+
+	EventLoop event_loop;
+	const ScopeCurlInit curl_init;
+	CurlGlobal curl_global{event_loop, nullptr};
+
+	ScrobblerConfig config;
+	server.Configure(config);
+
+	const auto health = std::make_shared<HostHealth>("test");
+	auto scrobbler = std::make_unique<Scrobbler>(config, event_loop,
+						     curl_global, health);
+
+	/* wait for the (local) ListenBrainz handshake */
+	Breaker breaker{event_loop, std::chrono::seconds{2}};
+	event_loop.Run();
+
+	/* open the circuit with a backoff which has already
+	   expired */
+	health->OnFailure(event_loop.SteadyNow() - std::chrono::hours{1},
+			  std::chrono::seconds{1});
+	Check(!health->IsProbing(), "circuit is open");
+
+	const auto song = MakeRecord(0);
+	scrobbler->ScheduleNowPlaying(song);
+	Check(health->IsProbing(), "'now playing' is the probe");
+
+	/* the song is skipped before the probe has finished */
+	Check(scrobbler->DiscardNowPlaying(*song), "probe canceled");
+	Check(!health->IsProbing(), "probe released on discard");
+
+	/* the next song gets to send the probe right away instead of
+	   waiting for HostHealth::PROBE_TIMEOUT */
+	scrobbler->ScheduleNowPlaying(MakeRecord(1));
+	Check(health->IsProbing(), "next song sends the probe");
+
+	/* the probe in flight is released when the scrobbler goes
+	   away */
+	scrobbler.reset();
+	Check(!health->IsProbing(), "probe released on shutdown");
+}
+
+int
+main() noexcept
+try {
+	TestNowPlayingDelay();
+	TestSharedScrobbler();
+	TestDiscardReleasesProbe();
+
+	return TestExitStatus();
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Verify that a song which is always rejected is isolated and moved
+ * to the quarantine file, and the other songs are submitted.
+ */
+
+#include "MockListenBrainz.hxx"
+#include "TestUtil.hxx"
+#include "Scrobbler.hxx"
+#include "ScrobblerConfig.hxx"
+#include "lib/curl/Global.hxx"
+#include "lib/curl/Init.hxx"
+#include "event/Loop.hxx"
+#include "system/Error.hxx"
+#include "util/PrintException.hxx"
+
+#include <fmt/core.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void
+TestQuarantine()
+{
+	char directory[] = "/tmp/TestQuarantine.XXXXXX";
+	if (mkdtemp(directory) == nullptr)
+		throw MakeErrno("mkdtemp() failed");
+
+	const std::string quarantine = fmt::format("{}/quarantine", directory);
+
+	MockListenBrainz server;
+
+	EventLoop event_loop;
+	const ScopeCurlInit curl_init;
+	CurlGlobal curl_global{event_loop, nullptr};
+
+	ScrobblerConfig config;
+	server.Configure(config);
+	config.quarantine = quarantine;
+	config.max_batch = 10;
+
+	/* a second batch being accepted proves that the server is
+	   working, so the batch with the rejected song can be split
+	   without backoff */
+	config.submit_window = 2;
+
+	Scrobbler scrobbler{config, event_loop, curl_global};
+
+	for (unsigned i = 0; i < 20; ++i)
+		scrobbler.Push(i == 7
+			       ? std::make_shared<const Record>("Artist", "Poison",
+								"", "", "",
+								RECORD_EPOCH,
+								std::chrono::seconds{180},
+								false, false)
+			       : MakeRecord(i));
+
+	const auto start = std::chrono::steady_clock::now();
+	ListensPoller poller{event_loop, server, 19};
+	event_loop.Run();
+
+	/* no backoff delay */
+	Check(std::chrono::steady_clock::now() - start < std::chrono::seconds{30},
+	      "quarantine duration");
+
+	server.CheckErrors();
+	Check(server.CountListens() == 19, "other songs accepted");
+
+	FILE *file = fopen(quarantine.c_str(), "r");
+	Check(file != nullptr, "quarantine file exists");
+	if (file != nullptr) {
+		char buffer[1024];
+		const std::size_t length = fread(buffer, 1, sizeof(buffer), file);
+		fclose(file);
+
+		const std::string_view contents{buffer, length};
+		Check(contents.find("t = Poison\n") != contents.npos &&
+		      contents.find("Track") == contents.npos,
+		      "quarantine file contents");
+	}
+
+	unlink(quarantine.c_str());
+	rmdir(directory);
+}
+
+int
+main() noexcept
+try {
+	TestQuarantine();
+
+	return TestExitStatus();
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
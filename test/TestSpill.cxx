@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Verify that songs exceeding "max_queue" are spilled to disk and
+ * submitted in the right order, and that songs which could not be
+ * spilled are loaded back from the journal.
+ */
+
+#include "MockListenBrainz.hxx"
+#include "TestUtil.hxx"
+#include "Scrobbler.hxx"
+#include "ScrobblerConfig.hxx"
+#include "lib/curl/Global.hxx"
+#include "lib/curl/Init.hxx"
+#include "event/Loop.hxx"
+#include "system/Error.hxx"
+#include "util/PrintException.hxx"
+
+#include <fmt/core.h>
+
+#include <stdio.h> // for rename()
+#include <stdlib.h>
+#include <unistd.h>
+
+static void
+TestSpill()
+{
+	char directory[] = "/tmp/TestSpill.XXXXXX";
+	if (mkdtemp(directory) == nullptr)
+		throw MakeErrno("mkdtemp() failed");
+
+	const std::string journal = fmt::format("{}/journal", directory);
+
+	MockListenBrainz server;
+
+	EventLoop event_loop;
+	const ScopeCurlInit curl_init;
+	CurlGlobal curl_global{event_loop, nullptr};
+
+	ScrobblerConfig config;
+	server.Configure(config);
+	config.journal = journal;
+	config.journal_format = JournalFormat::BINARY;
+	config.max_batch = 20;
+	config.max_queue = 30;
+
+	{
+		Scrobbler scrobbler{config, event_loop, curl_global};
+
+		for (unsigned i = 0; i < 100; ++i)
+			scrobbler.Push(MakeRecord(i));
+
+		ListensPoller poller{event_loop, server, 100};
+		event_loop.Run();
+	}
+
+	server.CheckErrors();
+
+	const auto r = server.GetRequests();
+	Check(r.size() == 5, "number of spill requests");
+
+	for (std::size_t i = 0; i < r.size(); ++i)
+		Check(r[i].n_listens == 20 &&
+		      r[i].track_name == fmt::format("Track {}", i * 20),
+		      "spilled songs in order");
+
+	unlink(journal.c_str());
+
+	/* the spill file must not be left behind */
+	Check(rmdir(directory) == 0, "spill file deleted");
+}
+
+static void
+TestJournalOnly()
+{
+	char directory[] = "/tmp/TestSpill.XXXXXX";
+	if (mkdtemp(directory) == nullptr)
+		throw MakeErrno("mkdtemp() failed");
+
+	const std::string journal = fmt::format("{}/journal", directory);
+	const std::string moved = fmt::format("{}.moved", directory);
+
+	MockListenBrainz server;
+
+	EventLoop event_loop;
+	const ScopeCurlInit curl_init;
+	CurlGlobal curl_global{event_loop, nullptr};
+
+	ScrobblerConfig config;
+	server.Configure(config);
+	config.journal = journal;
+	config.journal_format = JournalFormat::BINARY;
+	config.max_batch = 10;
+	config.max_queue = 10;
+
+	{
+		Scrobbler scrobbler{config, event_loop, curl_global};
+
+		/* this opens the journal file */
+		for (unsigned i = 0; i < 10; ++i)
+			scrobbler.Push(MakeRecord(i));
+
+		/* the spill file cannot be created while the
+		   directory is gone, but the journal file is still
+		   open */
+		if (rename(directory, moved.c_str()) < 0)
+			throw MakeErrno("rename() failed");
+
+		for (unsigned i = 10; i < 30; ++i)
+			scrobbler.Push(MakeRecord(i));
+
+		if (rename(moved.c_str(), directory) < 0)
+			throw MakeErrno("rename() failed");
+
+		ListensPoller poller{event_loop, server, 30};
+		event_loop.Run();
+	}
+
+	server.CheckErrors();
+
+	const auto r = server.GetRequests();
+	Check(r.size() == 3, "number of journal-only requests");
+
+	for (std::size_t i = 0; i < r.size(); ++i)
+		Check(r[i].n_listens == 10 &&
+		      r[i].track_name == fmt::format("Track {}", i * 10),
+		      "journal-only songs in order");
+
+	unlink(journal.c_str());
+	rmdir(directory);
+}
+
+int
+main() noexcept
+try {
+	TestSpill();
+	TestJournalOnly();
+
+	return TestExitStatus();
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#pragma once
+
+/*
+ * Helpers shared by the unit tests.
+ */
+
+#include "Record.hxx"
+
+#include <fmt/core.h>
+
+#include <chrono>
+#include <memory>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Set by Check() when a condition does not hold.
+ */
+inline bool test_failed = false;
+
+inline void
+Check(bool condition, const char *what) noexcept
+{
+	if (!condition) {
+		fmt::print(stderr, "FAILED: {}\n", what);
+		test_failed = true;
+	}
+}
+
+/**
+ * The exit status of the test program.
+ */
+inline int
+TestExitStatus() noexcept
+{
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * When MakeRecord(0) was played (unless specified otherwise).
+ */
+inline constexpr std::chrono::sys_seconds RECORD_EPOCH{std::chrono::seconds{1700000000}};
+
+/**
+ * Create the song "Track N".  Consecutive songs were played 200
+ * seconds apart beginning at #first, and every other one is loved.
+ * The default artist and album contain characters which need to be
+ * escaped.
+ */
+inline RecordPtr
+MakeRecord(unsigned i, const char *artist="Artist \"Quoted\"",
+	   std::chrono::sys_seconds first=RECORD_EPOCH) noexcept
+{
+	return std::make_shared<const Record>(artist,
+					      fmt::format("Track {}", i),
+					      "Album\\Path", "7",
+					      "b1a9c0e9-d987-4042-ae91-78d6a3267d69",
+					      first + std::chrono::seconds{i * 200},
+					      std::chrono::seconds{180},
+					      i % 2 == 0, false);
+}